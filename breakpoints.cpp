@@ -4,104 +4,162 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #define INSN_IS_COMPRESSED(instr) ((instr & 0x3) != 0x3)
 #define INSN_BP_COMPRESSED   0x8002
 #define INSN_BP              0x00100073
 
+static bool bp_addr_less(const struct bp_insn& bp, unsigned int addr) {
+  return bp.addr < addr;
+}
+
+static bool bp_less(const struct bp_insn& a, const struct bp_insn& b) {
+  return a.addr < b.addr;
+}
+
+static bool bp_unused(const struct bp_insn& bp) {
+  return bp.refcount == 0;
+}
+
 BreakPoints::BreakPoints(MemIF* mem, Cache* cache) {
   m_mem   = mem;
   m_cache = cache;
 }
 
+std::vector<struct bp_insn>::iterator
+BreakPoints::lower_bound(unsigned int addr) {
+  return std::lower_bound(m_bps.begin(), m_bps.end(), addr, bp_addr_less);
+}
+
+struct bp_insn*
+BreakPoints::find(unsigned int addr) {
+  std::vector<struct bp_insn>::iterator it = this->lower_bound(addr);
+
+  if (it == m_bps.end() || it->addr != addr || it->refcount == 0)
+    return NULL;
+
+  return &(*it);
+}
+
 bool
 BreakPoints::insert(unsigned int addr) {
-  bool retval;
-  uint32_t data_bp;
-  struct bp_insn bp;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-  bp.addr = addr;
-  retval = m_mem->access(0, addr, 4, (char*)&bp.insn_orig);
-  bp.is_compressed = INSN_IS_COMPRESSED(bp.insn_orig);
+  std::vector<struct bp_insn>::iterator it = this->lower_bound(addr);
 
-  m_bp_list.push_back(bp);
+  // several clients might share the same breakpoint, it must only be written
+  // once. A breakpoint which was removed but not committed yet is also still
+  // in memory.
+  if (it != m_bps.end() && it->addr == addr) {
+    if (it->refcount == 0)
+      it->enabled = true;
 
-  if (bp.is_compressed) {
-    data_bp = INSN_BP_COMPRESSED;
-    retval = retval && m_mem->access(1, addr, 2, (char*)&data_bp);
-  } else {
-    data_bp = INSN_BP;
-    retval = retval && m_mem->access(1, addr, 4, (char*)&data_bp);
+    it->refcount++;
+    return true;
   }
 
-  return retval && m_cache->flush();
+  struct bp_insn bp;
+  bp.addr = addr;
+  bp.insn_orig = 0;
+  bp.is_compressed = false;
+  bp.orig_valid = false;
+  bp.enabled = true;
+  bp.patched = false;
+  bp.dirty = false;
+  bp.refcount = 1;
+
+  m_bps.insert(it, bp);
+
+  return true;
 }
 
 bool
-BreakPoints::remove(unsigned int addr) {
+BreakPoints::insert(std::vector<unsigned int> addrs) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  size_t nb_bps = m_bps.size();
+
+  std::sort(addrs.begin(), addrs.end());
 
-  bool retval;
-  bool is_compressed;
-  uint32_t data;
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    if (it->addr == addr) {
-      data = it->insn_orig;
-      is_compressed = it->is_compressed;
+  // new breakpoints are appended, then merged with the existing ones
+  for (size_t i = 0; i < addrs.size(); i++) {
+    std::vector<struct bp_insn>::iterator it = std::lower_bound(m_bps.begin(), m_bps.begin() + nb_bps, addrs[i], bp_addr_less);
 
-      m_bp_list.erase(it);
+    if (it != m_bps.begin() + nb_bps && it->addr == addrs[i]) {
+      if (it->refcount == 0)
+        it->enabled = true;
 
-      if (is_compressed)
-        retval = m_mem->access(1, addr, 2, (char*)&data);
-      else
-        retval = m_mem->access(1, addr, 4, (char*)&data);
+      it->refcount++;
+      continue;
+    }
 
-      return retval && m_cache->flush();
+    if (m_bps.size() > nb_bps && m_bps.back().addr == addrs[i]) {
+      m_bps.back().refcount++;
+      continue;
     }
+
+    struct bp_insn bp;
+    bp.addr = addrs[i];
+    bp.insn_orig = 0;
+    bp.is_compressed = false;
+    bp.orig_valid = false;
+    bp.enabled = true;
+    bp.patched = false;
+    bp.dirty = false;
+    bp.refcount = 1;
+
+    m_bps.push_back(bp);
   }
 
-  return false;
+  std::inplace_merge(m_bps.begin(), m_bps.begin() + nb_bps, m_bps.end(), bp_less);
+
+  return true;
 }
 
 bool
-BreakPoints::clear() {
+BreakPoints::remove(unsigned int addr) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  std::vector<struct bp_insn>::iterator it = this->lower_bound(addr);
+
+  if (it == m_bps.end() || it->addr != addr || it->refcount == 0)
+    return false;
+
+  // it stays until the next commit if it has to be taken out of memory
+  if (--it->refcount == 0 && !it->patched)
+    m_bps.erase(it);
+
+  return true;
+}
 
-  bool retval = this->disable_all();
+bool
+BreakPoints::clear() {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-  m_bp_list.clear();
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    it->refcount = 0;
+  }
 
-  return retval;
+  return this->commit();
 }
 
 
 bool
 BreakPoints::at_addr(unsigned int addr) {
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    if (it->addr == addr) {
-      // we found our bp
-      return true;
-    }
-  }
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-  return false;
+  return this->find(addr) != NULL;
 }
 
 bool
 BreakPoints::enable(unsigned int addr) {
-  bool retval;
-  uint32_t data;
-
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    if (it->addr == addr) {
-      if (it->is_compressed) {
-        data = INSN_BP_COMPRESSED;
-        retval = m_mem->access(1, addr, 2, (char*)&data);
-      } else {
-        data = INSN_BP;
-        retval = m_mem->access(1, addr, 4, (char*)&data);
-      }
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-      return retval && m_cache->flush();
-    }
+  struct bp_insn* bp = this->find(addr);
+  if (bp) {
+    bp->enabled = true;
+    return true;
   }
 
   fprintf(stderr, "bp_enable: Did not find any bp at addr %08X\n", addr);
@@ -111,17 +169,12 @@ BreakPoints::enable(unsigned int addr) {
 
 bool
 BreakPoints::disable(unsigned int addr) {
-  bool retval;
-
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    if (it->addr == addr) {
-      if (it->is_compressed)
-        retval = m_mem->access(1, addr, 2, (char*)&it->insn_orig);
-      else
-        retval = m_mem->access(1, addr, 4, (char*)&it->insn_orig);
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-      return retval && m_cache->flush();
-    }
+  struct bp_insn* bp = this->find(addr);
+  if (bp) {
+    bp->enabled = false;
+    return true;
   }
 
   fprintf(stderr, "bp_enable: Did not find any bp at addr %08X\n", addr);
@@ -131,22 +184,144 @@ BreakPoints::disable(unsigned int addr) {
 
 bool
 BreakPoints::enable_all() {
-  bool retval = true;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    retval = retval && this->enable(it->addr);
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    it->enabled = true;
   }
 
-  return retval;
+  return true;
 }
 
 bool
 BreakPoints::disable_all() {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    it->enabled = false;
+  }
+
+  return true;
+}
+
+bool
+BreakPoints::commit() {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  static uint32_t insn_bp = INSN_BP;
+  static uint32_t insn_bp_compressed = INSN_BP_COMPRESSED;
+  std::vector<struct mem_txn> txns;
   bool retval = true;
 
-  for (std::list<struct bp_insn>::iterator it = m_bp_list.begin(); it != m_bp_list.end(); it++) {
-    retval = retval && this->disable(it->addr);
+  // First fetch the original instructions of the new breakpoints, all of them
+  // in one go
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    if (!it->orig_valid && it->refcount > 0) {
+      struct mem_txn txn = { false, it->addr, 4, (char*)&it->insn_orig };
+      txns.push_back(txn);
+    }
+  }
+
+  if (txns.size()) {
+    retval = m_mem->access_batch(&txns[0], txns.size());
+
+    for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+      if (!it->orig_valid && it->refcount > 0) {
+        it->is_compressed = INSN_IS_COMPRESSED(it->insn_orig);
+        it->orig_valid = true;
+      }
+    }
+
+    txns.clear();
+  }
+
+  // Then patch everything which differs from what is in memory
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    bool wanted = it->refcount > 0 && it->enabled;
+
+    if (wanted == it->patched && !it->dirty)
+      continue;
+
+    struct mem_txn txn = { true, it->addr, it->is_compressed ? 2 : 4, (char*)&it->insn_orig };
+    if (wanted)
+      txn.buffer = it->is_compressed ? (char*)&insn_bp_compressed : (char*)&insn_bp;
+
+    txns.push_back(txn);
+  }
+
+  if (txns.size())
+    retval = m_mem->access_batch(&txns[0], txns.size()) && retval;
+
+  // only the patched instructions and the code written by gdb are invalidated
+  std::vector<struct cache_range> ranges = m_written;
+  for (size_t i = 0; i < txns.size(); i++) {
+    struct cache_range range = { txns[i].addr, txns[i].size };
+    ranges.push_back(range);
   }
+  m_written.clear();
 
-  return retval;
+  for (std::vector<struct bp_insn>::iterator it = m_bps.begin(); it != m_bps.end(); it++) {
+    it->patched = it->refcount > 0 && it->enabled;
+    it->dirty = false;
+  }
+
+  m_bps.erase(std::remove_if(m_bps.begin(), m_bps.end(), bp_unused), m_bps.end());
+
+  if (ranges.size() == 0)
+    return retval;
+
+  return m_cache->invalidate(&ranges[0], ranges.size()) && retval;
+}
+
+void
+BreakPoints::merge(struct bp_insn* bp, unsigned int addr, int size, char* buffer, bool to_orig) {
+  char* orig = (char*)&bp->insn_orig;
+  int len = bp->orig_valid && bp->is_compressed ? 2 : 4;
+
+  for (int i = 0; i < len; i++) {
+    unsigned int byte_addr = bp->addr + i;
+    if (byte_addr < addr || byte_addr >= addr + size)
+      continue;
+
+    if (to_orig)
+      orig[i] = buffer[byte_addr - addr];
+    else
+      buffer[byte_addr - addr] = orig[i];
+  }
+}
+
+void
+BreakPoints::hide(unsigned int addr, int size, char* buffer) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  // an instruction starting up to 3 bytes before might overlap
+  for (std::vector<struct bp_insn>::iterator it = this->lower_bound(addr < 3 ? 0 : addr - 3); it != m_bps.end() && it->addr < addr + size; it++) {
+    if (it->patched)
+      this->merge(&(*it), addr, size, buffer, false);
+  }
+}
+
+void
+BreakPoints::written(unsigned int addr, int size, const char* buffer) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+  // gdb writes big areas (e.g. when loading) as consecutive packets
+  if (m_written.size() && m_written.back().addr + m_written.back().len == addr) {
+    m_written.back().len += size;
+  } else {
+    struct cache_range range = { addr, size };
+    m_written.push_back(range);
+  }
+
+  for (std::vector<struct bp_insn>::iterator it = this->lower_bound(addr < 3 ? 0 : addr - 3); it != m_bps.end() && it->addr < addr + size; it++) {
+    if (!it->orig_valid)
+      continue;
+
+    this->merge(&(*it), addr, size, (char*)buffer, true);
+    it->is_compressed = INSN_IS_COMPRESSED(it->insn_orig);
+
+    // whatever should be in memory is written again at the next commit
+    if (it->patched)
+      it->dirty = true;
+  }
 }
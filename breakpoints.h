@@ -3,7 +3,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <list>
+#include <vector>
+#include <mutex>
 
 #include "mem.h"
 #include "cache.h"
@@ -12,8 +13,19 @@ struct bp_insn {
   uint32_t addr;
   uint32_t insn_orig;
   bool is_compressed;
+  bool orig_valid; // insn_orig has been read from memory
+  bool enabled;    // the breakpoint should be in memory
+  bool patched;    // the breakpoint is currently in memory
+  bool dirty;      // memory was written over the breakpoint
+  int refcount; // number of clients which inserted this breakpoint, 0 once
+                // removed but still in memory
 };
 
+// Changes to the breakpoints are only staged, they are written to memory by
+// commit, in one batch followed by a single cache flush. This must be done
+// before the cores are resumed. Only the difference with what is already in
+// memory is written, thus removing and inserting the same breakpoints around
+// a stop costs nothing.
 class BreakPoints {
   public:
     BreakPoints(MemIF* mem, Cache* cache);
@@ -21,6 +33,10 @@ class BreakPoints {
     bool insert(unsigned int addr);
     bool remove(unsigned int addr);
 
+    // Same as inserting them one by one, without moving the existing
+    // breakpoints for each of them
+    bool insert(std::vector<unsigned int> addrs);
+
     bool clear();
 
     bool at_addr(unsigned int addr);
@@ -31,8 +47,28 @@ class BreakPoints {
     bool disable(unsigned int addr);
     bool enable(unsigned int addr);
 
+    bool commit();
+
+    // Replaces the breakpoints found in memory which was read by the original
+    // instructions, as gdb expects to see them
+    void hide(unsigned int addr, int size, char* buffer);
+    // Memory was written, the original instructions are updated and the
+    // breakpoints in the range are written again at the next commit, which
+    // also invalidates the range in the instruction cache
+    void written(unsigned int addr, int size, const char* buffer);
+
   private:
-    std::list<struct bp_insn> m_bp_list;
+    std::vector<struct bp_insn>::iterator lower_bound(unsigned int addr);
+    struct bp_insn* find(unsigned int addr);
+    void merge(struct bp_insn* bp, unsigned int addr, int size, char* buffer, bool to_orig);
+
+    // sorted by address, lookups are binary searches and range lookups for
+    // memory accesses only visit the breakpoints in the range
+    std::vector<struct bp_insn> m_bps;
+    // ranges written since the last commit, to be invalidated in the cache
+    std::vector<struct cache_range> m_written;
+    // shared by all clients of a target, which run in their own threads
+    std::recursive_mutex m_mutex;
     MemIF* m_mem;
     Cache* m_cache;
 };
@@ -64,6 +64,18 @@ Bridge::Bridge(Platforms platform, MemIF *memIF, LogIF *log) {
 void Bridge::initBridge(Platforms platform, int portNumber, MemIF *memIF, LogIF *log) {
 
   // initialization
+  rspPort = 1234;
+  rspUnixPath = NULL;
+  rspPipeIn = -1;
+  rspPipeOut = -1;
+
+  cache = NULL;
+  bp = NULL;
+  loader = NULL;
+  checkpoint = NULL;
+  rtt = NULL;
+  server = NULL;
+
   if (log == NULL)
     this->log = this;
   else
@@ -71,19 +83,22 @@ void Bridge::initBridge(Platforms platform, int portNumber, MemIF *memIF, LogIF
 
 #ifdef FPGA
 #ifdef PULPEMU
-  mem = new ZynqAPBSPIIF();
+  link = new ZynqAPBSPIIF();
 #else
-  mem = new FpgaIF();
+  link = new FpgaIF();
 #endif
 #else
-  if (portNumber != -1) mem = new SimIF("localhost", portNumber);
-  else if (memIF != NULL) mem = memIF;
+  if (portNumber != -1) link = new SimIF("localhost", portNumber);
+  else if (memIF != NULL) link = memIF;
   else {
     fprintf(stderr, "Either a memory interface or a port number must be provided\n");
     exit (-1);
   }
 #endif
 
+  // all target accesses go through one worker thread
+  mem = new MemQueue(link);
+
   if (platform == unknown) {
     printf ("Unknown platform, trying auto-detect\n");
     platform = platform_detect(mem);
@@ -111,33 +126,144 @@ void Bridge::initBridge(Platforms platform, int portNumber, MemIF *memIF, LogIF
   }
 
   bp = new BreakPoints(mem, cache);
+  loader = new Loader(mem, bp, this->log);
+  checkpoint = new Checkpoint(mem, bp, loader);
+  rtt = new Rtt(mem);
+
+  // by default checkpoints contain all data memories, which is also where
+  // the RTT control block is searched for
+  if (platform == PULPino) {
+    checkpoint->add_region(0x00100000, 0x8000);
+    rtt->add_region(0x00100000, 0x8000);
+  } else {
+    checkpoint->add_region(0x1C000000, 0x80000);
+    checkpoint->add_region(0x10000000, 0x10000);
+    rtt->add_region(0x1C000000, 0x80000);
+    rtt->add_region(0x10000000, 0x10000);
+  }
 
-  rsp = new Rsp(1234, mem, this->log, dbgifs, bp);
+  server = new RspServer(mem, this->log, dbgifs, bp, loader, checkpoint, rtt);
 }
 
-void Bridge::mainLoop()
+void Bridge::listenTcp(int port)
+{
+  rspPort = port;
+  rspUnixPath = NULL;
+  rspPipeIn = -1;
+}
+
+void Bridge::listenUnix(const char *path)
+{
+  rspUnixPath = path;
+  rspPipeIn = -1;
+}
+
+void Bridge::listenPipe(int fdIn, int fdOut)
+{
+  rspPipeIn = fdIn;
+  rspPipeOut = fdOut;
+  rspUnixPath = NULL;
+}
+
+bool Bridge::open(Reactor *reactor)
+{
+  if (server == NULL)
+    return false;
+
+  if (rspPipeIn != -1)
+    return server->open_pipe(reactor, rspPipeIn, rspPipeOut);
+  else if (rspUnixPath != NULL)
+    return server->open_unix(reactor, rspUnixPath);
+  else
+    return server->open(reactor, rspPort);
+}
+
+void Bridge::close()
+{
+  if (server != NULL)
+    server->close();
+
+  if (rtt != NULL)
+    rtt->stop();
+
+  // don't leave any breakpoint behind in memory
+  if (bp != NULL)
+    bp->clear();
+}
+
+bool Bridge::load(const char *path)
+{
+  char report[256];
+
+  if (loader == NULL || !loader->load(path))
+    return false;
+
+  loader->set_entry(&dbgifs);
+  loader->get_report(report, sizeof(report));
+  log->user("%s", report);
+
+  return true;
+}
+
+bool Bridge::rttChannel(unsigned int index, const char *output)
+{
+  return rtt != NULL && rtt->add_channel(index, output);
+}
+
+bool Bridge::startRtt(const char *where, const char *elf)
 {
-  // main loop
-  while (1) {
-    rsp->open();
-    while(!rsp->wait_client());
-    rsp->loop();
-    rsp->close();
+  uint32_t addr = 0;
+  char *end;
+
+  if (rtt == NULL)
+    return false;
+
+  if (strcmp(where, "scan") != 0) {
+    addr = strtoul(where, &end, 0);
+
+    if (*end != '\0') {
+      if (elf == NULL) {
+        fprintf(stderr, "RTT: A symbol can only be looked up in a loaded binary\n");
+        return false;
+      }
+
+      if (!Loader::find_symbol(elf, where, &addr))
+        return false;
+    }
   }
+
+  rtt->set_address(addr);
+  return rtt->start();
+}
+
+void Bridge::mainLoop()
+{
+  Reactor reactor;
+
+  // main loop, serves any number of clients until the server goes away
+  if (!open(&reactor))
+    return;
+
+  reactor.loop();
+  close();
 }
 
 Bridge::~Bridge()
 {
   // cleanup
-  delete rsp;
+  delete server;
 
   for (std::list<DbgIF*>::iterator it = dbgifs.begin(); it != dbgifs.end(); it++) {
     delete (*it);
   }
 
+  delete rtt;
+  delete checkpoint;
+  delete loader;
   delete bp;
   delete cache;
   delete mem;
+  delete link;
 }
 
 void Bridge::user(const char *str, ...)
@@ -4,11 +4,17 @@
 #include "mem_zynq_spi.h"
 #include "mem_zynq_apb_spi.h"
 #include "sim.h"
+#include "mem_queue.h"
 
 #include "debug_if.h"
 #include "cache.h"
 #include "breakpoints.h"
 #include "rsp.h"
+#include "rsp_server.h"
+#include "reactor.h"
+#include "loader.h"
+#include "checkpoint.h"
+#include "rtt.h"
 #include "log.h"
 
 enum Platforms { unknown, PULPino, PULP, GAP };
@@ -21,16 +27,43 @@ class Bridge : public LogIF {
     ~Bridge();
     void mainLoop();
 
+    // Selects where gdb connects to, by default TCP port 1234
+    void listenTcp(int port);
+    void listenUnix(const char *path);
+    void listenPipe(int fdIn, int fdOut);
+
+    bool open(Reactor *reactor);
+    void close();
+
+    // Loads an ELF file and points all cores to its entry point
+    bool load(const char *path);
+
+    // Forwards RTT channel index to output, cf. Rtt::add_channel
+    bool rttChannel(unsigned int index, const char *output);
+
+    // Starts polling the RTT buffers, the control block is searched for with
+    // "scan" or is at where, an address or a symbol of elf
+    bool startRtt(const char *where, const char *elf);
+
     void user(const char *str, ...);
     void debug(const char *str, ...);
 
   private:
-  MemIF* mem;
+  MemIF* link;
+  MemQueue* mem;
   std::list<DbgIF*> dbgifs;
   Cache* cache;
-  Rsp* rsp;
+  RspServer* server;
   BreakPoints* bp;
+  Loader* loader;
+  Checkpoint* checkpoint;
+  Rtt* rtt;
   LogIF *log;
+
+  int rspPort;
+  const char *rspUnixPath;
+  int rspPipeIn;
+  int rspPipeOut;
 };
 
 #endif
@@ -1,6 +1,7 @@
 
 #include "cache.h"
 #include <stdio.h>
+#include <vector>
 
 void Cache::flushCores() {
   for (std::list<DbgIF*>::iterator it = p_dbgIfList->begin(); it != p_dbgIfList->end(); it++) {
@@ -8,6 +9,12 @@ void Cache::flushCores() {
   }
 }
 
+bool
+Cache::invalidate(unsigned int addr, int len) {
+  struct cache_range range = { addr, len };
+  return this->invalidate(&range, 1);
+}
+
 PulpCache::PulpCache(MemIF* mem, std::list<DbgIF*>* p_dbgIfList, unsigned int addr) :
   Cache(mem, p_dbgIfList) {
   m_addr = addr;
@@ -18,7 +25,41 @@ bool
 PulpCache::flush() {
   uint32_t data = 0xFFFFFFFF;
   flushCores();
-  return m_mem->access(1, m_addr + 0x04, 4, (char*)&data);
+  return m_mem->access(1, m_addr + PULP_ICACHE_FLUSH, 4, (char*)&data);
+}
+
+bool
+PulpCache::invalidate(struct cache_range* ranges, int nb_ranges) {
+  std::vector<uint32_t> lines;
+
+  for (int i = 0; i < nb_ranges; i++) {
+    uint32_t first = ranges[i].addr & ~(PULP_ICACHE_LINE_SIZE - 1);
+
+    for (uint32_t line = first; line < ranges[i].addr + ranges[i].len; line += PULP_ICACHE_LINE_SIZE) {
+      // consecutive ranges often share a line
+      if (lines.size() && lines.back() == line)
+        continue;
+
+      lines.push_back(line);
+    }
+
+    if (lines.size() > PULP_ICACHE_SEL_FLUSH_MAX)
+      return PulpCache::flush();
+  }
+
+  if (lines.size() == 0)
+    return true;
+
+  // the selective flush register takes one address per write, all of them
+  // go out in one batch
+  std::vector<struct mem_txn> txns;
+  for (size_t i = 0; i < lines.size(); i++) {
+    struct mem_txn txn = { true, m_addr + PULP_ICACHE_SEL_FLUSH, 4, (char*)&lines[i] };
+    txns.push_back(txn);
+  }
+
+  flushCores();
+  return m_mem->access_batch(&txns[0], txns.size());
 }
 
 GAPCache::GAPCache(MemIF* mem, std::list<DbgIF*>* p_dbgIfList, unsigned int addr, unsigned int fc_addr) :
@@ -28,8 +69,20 @@ GAPCache::GAPCache(MemIF* mem, std::list<DbgIF*>* p_dbgIfList, unsigned int addr
 }
 
 bool
-GAPCache::flush() {
+GAPCache::flushFC() {
   uint32_t data = 0xFFFFFFFF;
+  return m_mem->access(1, m_fc_addr + 0x0C, 4, (char*)&data);
+}
+
+bool
+GAPCache::flush() {
   bool retval = PulpCache::flush();
-  return retval && m_mem->access(1, m_fc_addr + 0x0C, 4, (char*)&data);
+  return retval && this->flushFC();
+}
+
+bool
+GAPCache::invalidate(struct cache_range* ranges, int nb_ranges) {
+  // the fabric controller cache has no selective flush
+  bool retval = PulpCache::invalidate(ranges, nb_ranges);
+  return retval && this->flushFC();
 }
@@ -5,6 +5,20 @@
 #include "debug_if.h"
 #include <list>
 
+// Instruction cache controller of the PULP cluster
+#define PULP_ICACHE_FLUSH      0x04
+#define PULP_ICACHE_SEL_FLUSH  0x0C  // invalidates the line holding the written address
+#define PULP_ICACHE_LINE_SIZE  16
+
+// Above this amount of lines, a full flush is cheaper than flushing them one
+// by one
+#define PULP_ICACHE_SEL_FLUSH_MAX 64
+
+struct cache_range {
+  unsigned int addr;
+  int len;
+};
+
 class Cache {
   public:
     Cache(MemIF* mem, std::list<DbgIF*>* dbgIfList) { m_mem = mem; p_dbgIfList = dbgIfList; }
@@ -13,6 +27,11 @@ class Cache {
     virtual bool flush() { flushCores(); return true; }
     void flushCores();
 
+    // Makes sure that instructions written to the given ranges are seen by
+    // the cores. Caches which can not invalidate ranges are fully flushed.
+    virtual bool invalidate(struct cache_range* ranges, int nb_ranges) { return flush(); }
+    bool invalidate(unsigned int addr, int len);
+
   protected:
     MemIF* m_mem;
     std::list<DbgIF*>* p_dbgIfList;
@@ -23,6 +42,7 @@ class PulpCache : public Cache {
     PulpCache(MemIF* mem, std::list<DbgIF*>* p_dbgIfList, unsigned int addr);
 
     virtual bool flush();
+    virtual bool invalidate(struct cache_range* ranges, int nb_ranges);
 
   protected:
     unsigned int m_addr;
@@ -33,8 +53,11 @@ class GAPCache : public PulpCache {
     GAPCache(MemIF* mem, std::list<DbgIF*>* p_dbgIfList, unsigned int addr, unsigned int fc_addr);
 
     virtual bool flush();
+    virtual bool invalidate(struct cache_range* ranges, int nb_ranges);
 
   protected:
+    bool flushFC();
+
     unsigned int m_fc_addr;
 };
 
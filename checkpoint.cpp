@@ -0,0 +1,292 @@
+
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <vector>
+
+// mstatus, mie, mtvec, mscratch, mepc, mcause and the hardware loop registers
+static const unsigned int s_csrs[] = {
+  0x300, 0x304, 0x305, 0x340, 0x341, 0x342,
+  0x7B0, 0x7B1, 0x7B2, 0x7B4, 0x7B5, 0x7B6,
+};
+
+#define NB_CSRS (sizeof(s_csrs) / sizeof(s_csrs[0]))
+
+// thread id, GPRs, NPC and CSRs
+#define CORE_WORDS (1 + 32 + 1 + NB_CSRS)
+
+#define HEADER_WORDS 5
+
+Checkpoint::Checkpoint(MemIF* mem, BreakPoints* bp, Loader* loader) {
+  m_mem = mem;
+  m_bp = bp;
+  m_loader = loader;
+
+  m_name = "";
+  m_cores = 0;
+  m_bytes = 0;
+  m_seconds = 0;
+}
+
+bool
+Checkpoint::add_region(uint32_t addr, uint32_t len) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // regions follow each other in the file, which is accessed by words
+  if (len == 0 || (len & 0x3))
+    return false;
+
+  struct checkpoint_region region = { addr, len };
+  m_regions.push_back(region);
+  return true;
+}
+
+void
+Checkpoint::clear_regions() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  m_regions.clear();
+}
+
+std::list<struct checkpoint_region>
+Checkpoint::get_regions() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  return m_regions;
+}
+
+bool
+Checkpoint::save(const char* path, std::list<DbgIF*>* cores) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<struct mem_txn> txns;
+  size_t size = (HEADER_WORDS + cores->size() * CORE_WORDS) * 4;
+  bool retval = true;
+
+  m_name = "Saved";
+  m_cores = cores->size();
+  m_bytes = 0;
+
+  for (std::list<struct checkpoint_region>::iterator it = m_regions.begin(); it != m_regions.end(); it++) {
+    size += 8 + it->len;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "Checkpoint: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (ftruncate(fd, size) == -1) {
+    fprintf(stderr, "Checkpoint: Unable to resize %s: %s\n", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  char* file = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Checkpoint: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // PPC, HIT and CAUSE of each core, to tell where it is stopped
+  std::vector<uint32_t> stop(cores->size() * 3);
+  std::vector<uint32_t*> pcs;
+
+  uint32_t* words = (uint32_t*)file;
+  words[0] = CHECKPOINT_MAGIC;
+  words[1] = CHECKPOINT_VERSION;
+  words[2] = cores->size();
+  words[3] = NB_CSRS;
+  words[4] = m_regions.size();
+  words += HEADER_WORDS;
+
+  // the registers of all cores are read in one batch, straight into the file
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    words[0] = (*it)->get_thread_id();
+
+    struct mem_txn txn = (*it)->txn(0, 0x0400, &words[1]);
+    txn.size = 32 * 4;
+    txns.push_back(txn);
+
+    txns.push_back((*it)->txn(0, DBG_NPC_REG, &words[33]));
+    txns.push_back((*it)->txn(0, DBG_PPC_REG, &stop[i * 3]));
+    txns.push_back((*it)->txn(0, DBG_HIT_REG, &stop[i * 3 + 1]));
+    txns.push_back((*it)->txn(0, DBG_CAUSE_REG, &stop[i * 3 + 2]));
+    pcs.push_back(&words[33]);
+
+    for (unsigned int i = 0; i < NB_CSRS; i++) {
+      txns.push_back((*it)->txn(0, 0x4000 + s_csrs[i] * 4, &words[34 + i]));
+    }
+
+    words += CORE_WORDS;
+  }
+
+  if (txns.size())
+    retval = m_mem->access_batch(&txns[0], txns.size());
+
+  // A core stopped on a breakpoint or an illegal instruction is at PPC, same
+  // as in Rsp::pc_read
+  for (i = 0; i < pcs.size(); i++) {
+    uint32_t cause = stop[i * 3 + 2];
+
+    if (!(stop[i * 3 + 1] & 0x1) && !(cause & (1 << 31)) &&
+        ((cause & 0x1F) == CAUSE_BREAKPOINT || (cause & 0x1F) == CAUSE_ILLEGAL_INSN))
+      *pcs[i] = stop[i * 3];
+  }
+
+  for (std::list<struct checkpoint_region>::iterator it = m_regions.begin(); it != m_regions.end() && retval; it++) {
+    words[0] = it->addr;
+    words[1] = it->len;
+
+    char* data = (char*)&words[2];
+    retval = m_mem->access(0, it->addr, it->len, data);
+    m_bp->hide(it->addr, it->len, data);
+
+    m_bytes += it->len;
+    words = (uint32_t*)(data + it->len);
+  }
+
+  munmap(file, size);
+
+  if (!retval)
+    fprintf(stderr, "Checkpoint: Failed reading the target state\n");
+
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return retval;
+}
+
+bool
+Checkpoint::restore(const char* path, std::list<DbgIF*>* cores) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<struct mem_txn> txns;
+  struct stat st;
+  uint32_t hit = 0;
+  uint32_t cause = CAUSE_HALT;
+  bool retval = true;
+
+  m_name = "Restored";
+  m_cores = 0;
+  m_bytes = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Checkpoint: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < HEADER_WORDS * 4) {
+    fprintf(stderr, "Checkpoint: %s is not a checkpoint\n", path);
+    close(fd);
+    return false;
+  }
+
+  // private, the buffer is only read but MemIF takes a non-const one
+  char* file = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Checkpoint: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char* end = file + st.st_size;
+  uint32_t* words = (uint32_t*)file;
+
+  if (words[0] != CHECKPOINT_MAGIC || words[1] != CHECKPOINT_VERSION || words[3] != NB_CSRS ||
+      (size_t)st.st_size < (HEADER_WORDS + words[2] * CORE_WORDS) * 4) {
+    fprintf(stderr, "Checkpoint: %s is not a valid checkpoint\n", path);
+    munmap(file, st.st_size);
+    return false;
+  }
+
+  unsigned int nb_cores = words[2];
+  unsigned int nb_regions = words[4];
+  words += HEADER_WORDS;
+
+  for (unsigned int i = 0; i < nb_cores; i++) {
+    DbgIF* dbgif = NULL;
+
+    for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++) {
+      if ((*it)->get_thread_id() == words[0])
+        dbgif = *it;
+    }
+
+    if (dbgif == NULL) {
+      fprintf(stderr, "Checkpoint: Core %X is not debugged by this client, skipping it\n", words[0]);
+      words += CORE_WORDS;
+      continue;
+    }
+
+    struct mem_txn txn = dbgif->txn(1, 0x0400, &words[1]);
+    txn.size = 32 * 4;
+    txns.push_back(txn);
+
+    txns.push_back(dbgif->txn(1, DBG_NPC_REG, &words[33]));
+
+    // the core no longer stands on the breakpoint it might have stopped on,
+    // it must not be stepped over it on resume
+    txns.push_back(dbgif->txn(1, DBG_HIT_REG, &hit));
+    txns.push_back(dbgif->txn(1, DBG_CAUSE_REG, &cause));
+
+    for (unsigned int j = 0; j < NB_CSRS; j++) {
+      txns.push_back(dbgif->txn(1, 0x4000 + s_csrs[j] * 4, &words[34 + j]));
+    }
+
+    m_cores++;
+    words += CORE_WORDS;
+  }
+
+  if (txns.size())
+    retval = m_mem->access_batch(&txns[0], txns.size());
+
+  for (unsigned int i = 0; i < nb_regions && retval; i++) {
+    if ((char*)&words[2] > end || (char*)&words[2] + words[1] > end || (words[1] & 0x3)) {
+      fprintf(stderr, "Checkpoint: %s is truncated or corrupted\n", path);
+      retval = false;
+      break;
+    }
+
+    uint32_t addr = words[0];
+    uint32_t len = words[1];
+    char* data = (char*)&words[2];
+
+    retval = m_mem->access(1, addr, len, data);
+    m_bp->written(addr, len, data);
+    m_loader->written(addr, len);
+
+    m_bytes += len;
+    words = (uint32_t*)(data + len);
+  }
+
+  munmap(file, st.st_size);
+
+  if (!retval)
+    fprintf(stderr, "Checkpoint: Failed writing the target state\n");
+
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return retval;
+}
+
+void
+Checkpoint::get_report(char* str, size_t len) {
+  double rate = m_seconds > 0 ? m_bytes / m_seconds / 1e6 : 0;
+
+  snprintf(str, len, "%s %u cores and %llu bytes of memory in %.3f s (%.2f MB/s)\n",
+    m_name, m_cores, m_bytes, m_seconds, rate);
+}
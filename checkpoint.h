@@ -0,0 +1,58 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "mem.h"
+#include "debug_if.h"
+#include "breakpoints.h"
+#include "loader.h"
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+
+#define CHECKPOINT_MAGIC   0x504b4350  // "PCKP"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_region {
+  uint32_t addr;
+  uint32_t len;
+};
+
+// Saves the state of a set of cores (GPRs, PC and the main CSRs) and of a
+// list of memory regions to a file, and puts it back. Everything is read and
+// written with batches and bulk accesses. The cores must be halted.
+//
+// File layout, all little endian 32 bits words:
+//   magic, version, number of cores, number of CSRs, number of regions
+//   per core: thread id, 32 GPRs, NPC, CSRs
+//   per region: address, length, data
+class Checkpoint {
+  public:
+    Checkpoint(MemIF* mem, BreakPoints* bp, Loader* loader);
+
+    // len must be a multiple of 4
+    bool add_region(uint32_t addr, uint32_t len);
+    void clear_regions();
+    std::list<struct checkpoint_region> get_regions();
+
+    bool save(const char* path, std::list<DbgIF*>* cores);
+    bool restore(const char* path, std::list<DbgIF*>* cores);
+
+    // Summary of the last save or restore
+    void get_report(char* str, size_t len);
+
+  private:
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+    Loader* m_loader;
+
+    std::list<struct checkpoint_region> m_regions;
+    std::mutex m_mutex;
+
+    const char* m_name;
+    unsigned int m_cores;
+    unsigned long long m_bytes;
+    double m_seconds;
+};
+
+#endif
@@ -0,0 +1,164 @@
+
+#include "coverage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+// size of the last block in drcov files, which is not known
+#define DRCOV_LAST_BLOCK_SIZE 4
+
+Coverage::Coverage(BreakPoints* bp) {
+  m_bp = bp;
+  m_started = false;
+  m_seconds = 0;
+}
+
+Coverage::~Coverage() {
+  this->stop();
+}
+
+bool
+Coverage::load(const char* path) {
+  char line[1024];
+
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Coverage: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  m_blocks.clear();
+  m_hits.clear();
+
+  while (fgets(line, sizeof(line), file)) {
+    char* start = line + strspn(line, " \t");
+    char* end;
+
+    uint32_t addr = strtoul(start, &end, 16);
+    if (end == start || (*end != '\0' && *end != ':' && strchr(" \t\r\n", *end) == NULL))
+      continue;
+
+    m_blocks.push_back(addr);
+  }
+
+  fclose(file);
+
+  std::sort(m_blocks.begin(), m_blocks.end());
+  m_blocks.erase(std::unique(m_blocks.begin(), m_blocks.end()), m_blocks.end());
+  m_covered.assign(m_blocks.size(), false);
+
+  return true;
+}
+
+bool
+Coverage::start() {
+  std::vector<unsigned int> addrs;
+
+  if (m_started)
+    return true;
+
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    if (!m_covered[i])
+      addrs.push_back(m_blocks[i]);
+  }
+
+  m_started = true;
+  m_start = std::chrono::steady_clock::now();
+
+  return m_bp->insert(addrs);
+}
+
+void
+Coverage::stop() {
+  if (!m_started)
+    return;
+
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    if (!m_covered[i])
+      m_bp->remove(m_blocks[i]);
+  }
+
+  m_started = false;
+}
+
+bool
+Coverage::is_block(uint32_t addr) {
+  return std::binary_search(m_blocks.begin(), m_blocks.end(), addr);
+}
+
+bool
+Coverage::hit(uint32_t addr) {
+  std::vector<uint32_t>::iterator it = std::lower_bound(m_blocks.begin(), m_blocks.end(), addr);
+
+  // several cores may have reached it at the same time
+  if (it == m_blocks.end() || *it != addr || m_covered[it - m_blocks.begin()])
+    return false;
+
+  m_covered[it - m_blocks.begin()] = true;
+  m_hits.push_back(addr);
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+
+  if (m_started)
+    m_bp->remove(addr);
+
+  return true;
+}
+
+bool
+Coverage::write(const char* path, bool drcov, const char* module) {
+  FILE* file = fopen(path, drcov ? "wb" : "w");
+  if (file == NULL) {
+    fprintf(stderr, "Coverage: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (!drcov) {
+    for (size_t i = 0; i < m_hits.size(); i++)
+      fprintf(file, "0x%08x\n", m_hits[i]);
+  } else {
+    // one module covering the whole address space, so that offsets are
+    // absolute addresses
+    fprintf(file, "DRCOV VERSION: 2\n");
+    fprintf(file, "DRCOV FLAVOR: drcov\n");
+    fprintf(file, "Module Table: version 2, count 1\n");
+    fprintf(file, "Columns: id, base, end, entry, checksum, timestamp, path\n");
+    fprintf(file, " 0, 0x0000000000000000, 0x00000000ffffffff, 0x0000000000000000, 0x00000000, 0x00000000, %s\n",
+      module ? module : "unknown");
+    fprintf(file, "BB Table: %u bbs\n", (unsigned int)m_hits.size());
+
+    // a block ends where the next one starts
+    for (size_t i = 0; i < m_hits.size(); i++) {
+      std::vector<uint32_t>::iterator next = std::upper_bound(m_blocks.begin(), m_blocks.end(), m_hits[i]);
+      uint32_t size = next == m_blocks.end() ? DRCOV_LAST_BLOCK_SIZE : *next - m_hits[i];
+      if (size > 0xFFFF)
+        size = 0xFFFF;
+
+      struct {
+        uint32_t start;
+        uint16_t size;
+        uint16_t mod_id;
+      } __attribute__((packed)) entry = { m_hits[i], (uint16_t)size, 0 };
+
+      fwrite(&entry, sizeof(entry), 1, file);
+    }
+  }
+
+  bool retval = !ferror(file);
+  if (fclose(file) != 0 || !retval) {
+    fprintf(stderr, "Coverage: Unable to write %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+void
+Coverage::get_report(char* str, size_t len) {
+  double percent = m_blocks.size() ? 100.0 * m_hits.size() / m_blocks.size() : 0;
+
+  snprintf(str, len, "%u of %u blocks covered (%.1f%%), the last one after %.3f s\n",
+    (unsigned int)m_hits.size(), (unsigned int)m_blocks.size(), percent, m_seconds);
+}
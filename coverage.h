@@ -0,0 +1,60 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "breakpoints.h"
+
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+// Basic block coverage with one-shot breakpoints. A breakpoint is inserted at
+// the start of every block, all of them with one commit, thus one batch and
+// one cache flush. The first time a core reaches a block, the block is
+// recorded and its breakpoint is removed, so that the cost of the coverage
+// goes down as more code is covered.
+//
+// The blocks are read from a text file, the first word of each line being
+// the address in hexadecimal, which also accepts objdump -d lines. Lines which
+// do not start with an address are skipped.
+//
+// The covered blocks are written as a list of addresses, one per line, e.g.
+// for addr2line, or as a drcov file with absolute addresses for the binary
+// given as module.
+class Coverage {
+  public:
+    Coverage(BreakPoints* bp);
+    ~Coverage();
+
+    bool load(const char* path);
+
+    // Inserts or removes the breakpoints of the blocks not covered yet, the
+    // changes are written at the next commit
+    bool start();
+    void stop();
+
+    // One of the blocks, covered or not
+    bool is_block(uint32_t addr);
+
+    // A core reached addr, which is a block, returns whether it is new
+    bool hit(uint32_t addr);
+
+    bool write(const char* path, bool drcov, const char* module);
+
+    // Number of blocks covered and how long it took to cover them
+    void get_report(char* str, size_t len);
+
+  private:
+    BreakPoints* m_bp;
+
+    // sorted, and whether each one was covered
+    std::vector<uint32_t> m_blocks;
+    std::vector<bool> m_covered;
+    // blocks in the order they were covered
+    std::vector<uint32_t> m_hits;
+
+    bool m_started;
+    std::chrono::steady_clock::time_point m_start;
+    double m_seconds;
+};
+
+#endif
@@ -33,6 +33,47 @@ DbgIF::read(uint32_t addr, uint32_t* rdata) {
   return m_mem->access(0, m_base_addr + addr, 4, (char*)rdata);
 }
 
+struct mem_txn
+DbgIF::txn(bool write, unsigned int addr, uint32_t* data) {
+  struct mem_txn txn = { write, m_base_addr + addr, 4, (char*)data };
+  return txn;
+}
+
+void
+DbgIF::halt_txns(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns, uint32_t* ctrl_halt) {
+  uint32_t clusters = 0;
+
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++) {
+    unsigned int cluster_id = (*it)->get_thread_id() >> 5;
+    if (cores->size() > 1 && cluster_id < 32) {
+      if (clusters & (1 << cluster_id))
+        continue;
+      clusters |= 1 << cluster_id;
+    }
+
+    txns->push_back((*it)->txn(1, DBG_CTRL_REG, ctrl_halt));
+  }
+}
+
+void
+DbgIF::resume_txns(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns, uint32_t* ctrl_cont, uint32_t* mask) {
+  *ctrl_cont = 0;
+  *mask = 0;
+
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++) {
+    unsigned int thread_id = (*it)->get_thread_id();
+    if (cores->size() > 1 && (thread_id >> 5) < 32)
+      *mask |= 1 << (thread_id & 0x1F);
+    else
+      txns->push_back((*it)->txn(1, DBG_CTRL_REG, ctrl_cont));
+  }
+
+  if (*mask) {
+    struct mem_txn txn = { true, CLUSTER_RESUME_REG, 4, (char*)mask };
+    txns->push_back(txn);
+  }
+}
+
 bool
 DbgIF::halt() {
   uint32_t data;
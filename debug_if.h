@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <list>
+#include <vector>
 
 #define DBG_CTRL_REG  0x0
 #define DBG_HIT_REG   0x4
@@ -15,6 +17,18 @@
 #define DBG_NPC_REG   0x2000
 #define DBG_PPC_REG   0x2004
 
+// Cluster controller register, the cluster cores set in it are resumed
+#define CLUSTER_RESUME_REG 0x10200028
+
+// Cf. riscv_defines.sv and riscv_controller.sv (and RISCV debug draft 0.4)
+enum debug_causes {
+  CAUSE_ILLEGAL_INSN = 0x02, // Illegal instruction
+  CAUSE_BREAKPOINT   = 0x03, // Break point
+  CAUSE_ECALL_UMODE  = 0x08, // ECALL from User Mode
+  CAUSE_ECALL_MMODE  = 0x0B, // ECALL from Machine Mode
+  CAUSE_HALT         = 0x1F, // Halted through the debug unit
+};
+
 class DbgIF {
   public:
     DbgIF(MemIF* mem, unsigned int base_addr, LogIF *log);
@@ -28,6 +42,22 @@ class DbgIF {
     bool write(unsigned int addr, uint32_t wdata);
     bool read(unsigned int addr, uint32_t* rdata);
 
+    // Describes an access to a debug register, accesses to several registers
+    // or cores can then be done in one go with MemIF::access_batch
+    struct mem_txn txn(bool write, unsigned int addr, uint32_t* data);
+
+    // Appends the accesses halting running cores to txns. When there are
+    // several, the cluster is in all-stop mode, halting one of its cores
+    // stops the others, thus only one CTRL is written per cluster. The others
+    // are halted directly. ctrl_halt must stay valid until the batch is done.
+    static void halt_txns(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns, uint32_t* ctrl_halt);
+
+    // Appends the accesses resuming halted cores to txns. When there are
+    // several, cluster cores are resumed together through the cluster
+    // controller with mask, the others directly by writing ctrl_cont (0) to
+    // their CTRL. Both must stay valid until the batch is done.
+    static void resume_txns(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns, uint32_t* ctrl_cont, uint32_t* mask);
+
     bool gpr_write(unsigned int addr, uint32_t wdata);
     bool gpr_read_all(uint32_t* data);
     bool gpr_read(unsigned int addr, uint32_t* data);
@@ -0,0 +1,353 @@
+
+#include "loader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <vector>
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+static const char s_zeros[LOADER_ZERO_BURST] = { 0 };
+
+// FNV-1a, data is NULL for zeros
+static uint64_t page_hash(const char* data, uint32_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (uint32_t i = 0; i < size; i++) {
+    hash ^= data ? (uint8_t)data[i] : 0;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+Loader::Loader(MemIF* mem, BreakPoints* bp, LogIF* log) {
+  m_mem = mem;
+  m_bp = bp;
+  this->log = log;
+
+  m_entry = 0;
+  m_segments = 0;
+  m_bytes = 0;
+  m_pages_written = 0;
+  m_pages_skipped = 0;
+  m_pages_mismatch = 0;
+  m_seconds = 0;
+}
+
+bool
+Loader::write(uint32_t addr, uint32_t size, const char* data) {
+  // zeros are written in bursts from a static buffer
+  if (data == NULL) {
+    while (size > 0) {
+      uint32_t burst = size > LOADER_ZERO_BURST ? LOADER_ZERO_BURST : size;
+
+      if (!this->write(addr, burst, s_zeros))
+        return false;
+
+      addr += burst;
+      size -= burst;
+    }
+
+    return true;
+  }
+
+  // the buffer is only read for a write
+  if (!m_mem->access(1, addr, size, (char*)data)) {
+    fprintf(stderr, "Loader: Failed writing %d bytes at 0x%08X\n", size, addr);
+    return false;
+  }
+
+  // keep breakpoints and the instruction cache in sync with the new code
+  if (m_bp)
+    m_bp->written(addr, size, data);
+
+  m_bytes += size;
+  return true;
+}
+
+bool
+Loader::load_segment(uint32_t addr, uint32_t size, const char* data, bool writable, bool full, bool verify) {
+  std::vector<char> target;
+  uint32_t run_addr = addr;
+  uint32_t run_size = 0;
+  const char* run_data = data;
+
+  // Pages are compared with what the previous loads wrote, consecutive pages
+  // which have to be written are gathered into one burst
+  uint32_t offset = 0;
+  while (offset < size) {
+    uint32_t page_addr = addr + offset;
+    uint32_t page_size = LOADER_PAGE_SIZE - (page_addr % LOADER_PAGE_SIZE);
+    if (page_size > size - offset)
+      page_size = size - offset;
+
+    const char* page_data = data ? data + offset : NULL;
+    uint64_t hash = page_hash(page_data, page_size);
+
+    std::map<uint32_t, struct page>::iterator it = m_pages.find(page_addr);
+    bool unchanged = !full && it != m_pages.end() && it->second.size == page_size && it->second.hash == hash;
+
+    if (unchanged && verify) {
+      target.resize(page_size);
+      if (!m_mem->access(0, page_addr, page_size, &target[0]))
+        return false;
+
+      // breakpoints are part of what is in memory
+      if (m_bp)
+        m_bp->hide(page_addr, page_size, &target[0]);
+
+      if (page_hash(&target[0], page_size) != hash) {
+        unchanged = false;
+        m_pages_mismatch++;
+      }
+    } else if (unchanged && writable) {
+      unchanged = false;
+    }
+
+    if (unchanged) {
+      m_pages_skipped++;
+
+      if (run_size && !this->write(run_addr, run_size, run_data))
+        return false;
+
+      run_size = 0;
+    } else {
+      m_pages_written++;
+
+      if (run_size == 0) {
+        run_addr = page_addr;
+        run_data = page_data;
+      }
+      run_size += page_size;
+
+      // a previous load might have cut the pages differently
+      struct page page = { page_size, hash };
+      this->forget(page_addr, page_size);
+      m_pages[page_addr] = page;
+    }
+
+    offset += page_size;
+  }
+
+  if (run_size && !this->write(run_addr, run_size, run_data))
+    return false;
+
+  return true;
+}
+
+bool
+Loader::load(const char* path, bool full, bool verify) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  struct stat st;
+  bool retval = true;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  m_segments = 0;
+  m_bytes = 0;
+  m_pages_written = 0;
+  m_pages_skipped = 0;
+  m_pages_mismatch = 0;
+  m_seconds = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Loader: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+    fprintf(stderr, "Loader: %s is not an ELF file\n", path);
+    close(fd);
+    return false;
+  }
+
+  const char* file = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Loader: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  const Elf32_Ehdr* ehdr = (const Elf32_Ehdr*)file;
+
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_machine != EM_RISCV) {
+    fprintf(stderr, "Loader: %s is not a 32 bits RISC-V ELF file\n", path);
+    munmap((void*)file, st.st_size);
+    return false;
+  }
+
+  if (ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr) > (size_t)st.st_size) {
+    fprintf(stderr, "Loader: %s is truncated\n", path);
+    munmap((void*)file, st.st_size);
+    return false;
+  }
+
+  const Elf32_Phdr* phdrs = (const Elf32_Phdr*)(file + ehdr->e_phoff);
+
+  for (int i = 0; i < ehdr->e_phnum && retval; i++) {
+    const Elf32_Phdr* phdr = &phdrs[i];
+    bool writable = phdr->p_flags & PF_W;
+
+    if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0)
+      continue;
+
+    if ((size_t)phdr->p_offset + phdr->p_filesz > (size_t)st.st_size || phdr->p_filesz > phdr->p_memsz) {
+      fprintf(stderr, "Loader: Segment %d of %s is out of the file\n", i, path);
+      retval = false;
+      break;
+    }
+
+    log->debug("Loading segment at 0x%08X (file size 0x%x, memory size 0x%x)\n", phdr->p_paddr, phdr->p_filesz, phdr->p_memsz);
+
+    if (phdr->p_filesz)
+      retval = this->load_segment(phdr->p_paddr, phdr->p_filesz, file + phdr->p_offset, writable, full, verify);
+
+    // bss is always writable
+    if (retval && phdr->p_memsz > phdr->p_filesz)
+      retval = this->load_segment(phdr->p_paddr + phdr->p_filesz, phdr->p_memsz - phdr->p_filesz, NULL, true, full, verify);
+
+    m_segments++;
+  }
+
+  m_entry = ehdr->e_entry;
+
+  munmap((void*)file, st.st_size);
+
+  // after a failure, nothing is known about the target memory anymore
+  if (!retval)
+    m_pages.clear();
+
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return retval;
+}
+
+void
+Loader::written(unsigned int addr, int size) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  this->forget(addr, size);
+}
+
+void
+Loader::forget(unsigned int addr, int size) {
+  // the page holding addr may start before it
+  std::map<uint32_t, struct page>::iterator it = m_pages.upper_bound(addr);
+  if (it != m_pages.begin())
+    it--;
+
+  while (it != m_pages.end() && it->first < addr + size) {
+    if (it->first + it->second.size > addr)
+      m_pages.erase(it++);
+    else
+      it++;
+  }
+}
+
+bool
+Loader::set_entry(std::list<DbgIF*>* cores) {
+  bool retval = true;
+
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++) {
+    retval = (*it)->write(DBG_NPC_REG, m_entry) && retval;
+  }
+
+  return retval;
+}
+
+void
+Loader::get_report(char* str, size_t len) {
+  double rate = m_seconds > 0 ? m_bytes / m_seconds / 1e6 : 0;
+  int pos;
+
+  pos = snprintf(str, len, "Loaded %llu bytes in %u segments in %.3f s (%.2f MB/s), entry point 0x%08X\n",
+    m_bytes, m_segments, m_seconds, rate, m_entry);
+
+  if (pos < (int)len) {
+    snprintf(&str[pos], len - pos, "%u pages written, %u unchanged, %u differed on the target\n",
+      m_pages_written, m_pages_skipped, m_pages_mismatch);
+  }
+}
+
+bool
+Loader::find_symbol(const char* path, const char* name, uint32_t* addr) {
+  struct stat st;
+  bool found = false;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Loader: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+    fprintf(stderr, "Loader: %s is not an ELF file\n", path);
+    close(fd);
+    return false;
+  }
+
+  const char* file = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Loader: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  const Elf32_Ehdr* ehdr = (const Elf32_Ehdr*)file;
+
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+      ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr) > (size_t)st.st_size) {
+    fprintf(stderr, "Loader: %s is not a 32 bits ELF file\n", path);
+    munmap((void*)file, st.st_size);
+    return false;
+  }
+
+  const Elf32_Shdr* shdrs = (const Elf32_Shdr*)(file + ehdr->e_shoff);
+  size_t name_len = strlen(name);
+
+  for (int i = 0; i < ehdr->e_shnum && !found; i++) {
+    if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+      continue;
+
+    const Elf32_Shdr* strtab = &shdrs[shdrs[i].sh_link];
+    if (shdrs[i].sh_offset + shdrs[i].sh_size > (size_t)st.st_size ||
+        strtab->sh_offset + strtab->sh_size > (size_t)st.st_size)
+      continue;
+
+    const Elf32_Sym* syms = (const Elf32_Sym*)(file + shdrs[i].sh_offset);
+    size_t nb_syms = shdrs[i].sh_size / sizeof(Elf32_Sym);
+
+    for (size_t j = 0; j < nb_syms; j++) {
+      if (syms[j].st_shndx == SHN_UNDEF || syms[j].st_name + name_len >= strtab->sh_size)
+        continue;
+
+      if (memcmp(file + strtab->sh_offset + syms[j].st_name, name, name_len + 1) == 0) {
+        *addr = syms[j].st_value;
+        found = true;
+        break;
+      }
+    }
+  }
+
+  munmap((void*)file, st.st_size);
+
+  if (!found)
+    fprintf(stderr, "Loader: No symbol %s in %s\n", name, path);
+
+  return found;
+}
@@ -0,0 +1,75 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "mem.h"
+#include "debug_if.h"
+#include "breakpoints.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <mutex>
+
+// Writes zeros for bss sections in bursts of this size
+#define LOADER_ZERO_BURST 65536
+
+// Granularity at which reloads detect changes
+#define LOADER_PAGE_SIZE 4096
+
+// Loads ELF binaries into the target from the bridge host. Segments are
+// streamed to the memory interface in whole, which cuts them in the biggest
+// bursts it can handle.
+//
+// A hash of every page written by a load is kept, so that a reload of the
+// same program only writes the pages which changed. Writable segments are
+// always written as the program may have modified them, unless they are
+// verified against the target.
+class Loader {
+  public:
+    Loader(MemIF* mem, BreakPoints* bp, LogIF* log);
+
+    // full: write everything, verify: read back the unchanged pages and write
+    // those which differ on the target
+    bool load(const char* path, bool full=false, bool verify=false);
+
+    // Points all given cores to the entry point of the last loaded binary
+    bool set_entry(std::list<DbgIF*>* cores);
+
+    // Memory was written by someone else, forget what was loaded there
+    void written(unsigned int addr, int size);
+
+    // Summary of the last load
+    void get_report(char* str, size_t len);
+
+    // Looks up the address of a symbol in an ELF file
+    static bool find_symbol(const char* path, const char* name, uint32_t* addr);
+
+  private:
+    struct page {
+      uint32_t size;
+      uint64_t hash;
+    };
+
+    bool load_segment(uint32_t addr, uint32_t size, const char* data, bool writable, bool full, bool verify);
+    bool write(uint32_t addr, uint32_t size, const char* data);
+    void forget(unsigned int addr, int size);
+
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+    LogIF* log;
+
+    // hash of the content written by the last loads, by page start address
+    std::map<uint32_t, struct page> m_pages;
+    std::mutex m_mutex;
+
+    uint32_t m_entry;
+    unsigned int m_segments;
+    unsigned long long m_bytes;
+    unsigned int m_pages_written;
+    unsigned int m_pages_skipped;
+    unsigned int m_pages_mismatch;
+    double m_seconds;
+};
+
+#endif
@@ -1,7 +1,58 @@
 #include "bridge.h"
+#include "trace.h"
+
+// Output of RTT channel 0 when none is given, the usual RTT telnet port
+#define RTT_DEFAULT_OUTPUT "tcp:19021"
+
+struct target_desc {
+  int simPort;
+  int rspPort;
+  Platforms platform;
+};
+
+static bool parse_platform(const char *str, Platforms *platform) {
+  if (strcmp(str, "pulpino") == 0)
+    *platform = PULPino;
+  else if (strcmp(str, "pulp") == 0)
+    *platform = PULP;
+  else if (strcmp(str, "gap") == 0)
+    *platform = GAP;
+  else if (strcmp(str, "auto") == 0)
+    *platform = unknown;
+  else
+    return false;
+
+  return true;
+}
+
+// Target description, <simulator port>:<rsp port>[:<platform>]
+static bool parse_target(char *str, struct target_desc *target) {
+  char *simPort = strtok(str, ":");
+  char *rspPort = strtok(NULL, ":");
+  char *platform = strtok(NULL, ":");
+
+  if (simPort == NULL || rspPort == NULL)
+    return false;
+
+  target->simPort = atoi(simPort);
+  target->rspPort = atoi(rspPort);
+  target->platform = unknown;
+
+  if (platform != NULL && !parse_platform(platform, &target->platform))
+    return false;
+
+  return true;
+}
 
 int main(int argc, char **argv) {
   unsigned int portNumber = 4567;
+  const char *unixPath = NULL;
+  const char *loadPath = NULL;
+  const char *rttWhere = NULL;
+  std::list<std::pair<unsigned int, const char *> > rttChannels;
+  bool useStdio = false;
+  int stdioOut = -1;
+  std::list<struct target_desc> targets;
 
   int i;
   for (i=1; i<argc; i++)
@@ -15,6 +66,70 @@ int main(int argc, char **argv) {
       }
       portNumber = atoi(argv[i]);
     }
+    else if (strcmp(argv[i], "--unix") == 0)
+    {
+      i++;
+      if (i >= argc) {
+        fprintf(stderr, "Option --unix should take an argument\n");
+        exit(-1);
+      }
+      unixPath = argv[i];
+    }
+    else if (strcmp(argv[i], "--stdio") == 0)
+    {
+      useStdio = true;
+    }
+    else if (strcmp(argv[i], "--load") == 0)
+    {
+      i++;
+      if (i >= argc) {
+        fprintf(stderr, "Option --load should take an argument\n");
+        exit(-1);
+      }
+      loadPath = argv[i];
+    }
+    else if (strcmp(argv[i], "--rtt") == 0)
+    {
+      i++;
+      if (i >= argc) {
+        fprintf(stderr, "Option --rtt should take an argument\n");
+        exit(-1);
+      }
+      rttWhere = argv[i];
+    }
+    else if (strcmp(argv[i], "--rtt-channel") == 0)
+    {
+      char *output = NULL;
+      i++;
+      if (i < argc)
+        output = strchr(argv[i], ':');
+      if (output == NULL) {
+        fprintf(stderr, "Option --rtt-channel should take an argument of the form <channel>:<tcp:port|unix:path|file>\n");
+        exit(-1);
+      }
+      rttChannels.push_back(std::make_pair((unsigned int)atoi(argv[i]), output + 1));
+    }
+    else if (strcmp(argv[i], "--decode-trace") == 0)
+    {
+      i++;
+      if (i >= argc) {
+        fprintf(stderr, "Option --decode-trace should take an argument\n");
+        exit(-1);
+      }
+
+      // no target needed, only prints the file
+      return Trace::decode(argv[i], stdout) ? 0 : -1;
+    }
+    else if (strcmp(argv[i], "-t") == 0)
+    {
+      struct target_desc target;
+      i++;
+      if (i >= argc || !parse_target(argv[i], &target)) {
+        fprintf(stderr, "Option -t should take an argument of the form <sim port>:<rsp port>[:pulpino|pulp|gap|auto]\n");
+        exit(-1);
+      }
+      targets.push_back(target);
+    }
     else
     {
       fprintf(stderr, "Unknown option: %s\n", argv[i]);
@@ -22,7 +137,74 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (targets.size() != 0) {
+    if (useStdio || unixPath != NULL || rttWhere != NULL) {
+      fprintf(stderr, "Options --stdio, --unix and --rtt can not be used with several targets\n");
+      exit(-1);
+    }
+
+    // All targets are served from the same event loop, each one with its own
+    // memory and debug interfaces
+    Reactor reactor;
+    std::list<Bridge*> bridges;
+
+    for (std::list<struct target_desc>::iterator it = targets.begin(); it != targets.end(); it++) {
+      Bridge *bridge = new Bridge(it->platform, it->simPort);
+      bridge->listenTcp(it->rspPort);
+
+      if (loadPath != NULL && !bridge->load(loadPath))
+        fprintf(stderr, "Unable to load %s on simulator port %d\n", loadPath, it->simPort);
+
+      if (!bridge->open(&reactor)) {
+        fprintf(stderr, "Unable to serve target on simulator port %d\n", it->simPort);
+        delete bridge;
+        continue;
+      }
+
+      bridges.push_back(bridge);
+    }
+
+    reactor.loop();
+
+    for (std::list<Bridge*>::iterator it = bridges.begin(); it != bridges.end(); it++) {
+      (*it)->close();
+      delete *it;
+    }
+
+    return 0;
+  }
+
+  if (useStdio) {
+    // stdout now carries the RSP packets, everything else which is printed
+    // has to go to stderr
+    fflush(stdout);
+    stdioOut = dup(1);
+    dup2(2, 1);
+  }
+
   Bridge *bridge = new Bridge(unknown, portNumber);
+
+  if (loadPath != NULL && !bridge->load(loadPath))
+    fprintf(stderr, "Unable to load %s\n", loadPath);
+
+  if (rttWhere != NULL) {
+    if (rttChannels.empty())
+      rttChannels.push_back(std::make_pair(0U, RTT_DEFAULT_OUTPUT));
+
+    bool rtt = true;
+    for (std::list<std::pair<unsigned int, const char *> >::iterator it = rttChannels.begin(); it != rttChannels.end(); it++) {
+      rtt = bridge->rttChannel(it->first, it->second) && rtt;
+    }
+
+    if (!rtt || !bridge->startRtt(rttWhere, loadPath))
+      fprintf(stderr, "Unable to start RTT\n");
+  }
+
+  if (useStdio)
+    bridge->listenPipe(0, stdioOut);
+  else if (unixPath != NULL)
+    bridge->listenUnix(unixPath);
+
   bridge->mainLoop();
   delete bridge;
 
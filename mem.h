@@ -5,10 +5,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+struct mem_txn {
+  bool write;
+  unsigned int addr;
+  int size;
+  char* buffer;
+};
+
 class MemIF {
   public:
     virtual ~MemIF(){};
     virtual bool access(bool write, unsigned int addr, int size, char* buffer) = 0;
+    // Does all accesses in order, interfaces which can overlap them (e.g. by
+    // not waiting for each response) should override this
+    virtual bool access_batch(struct mem_txn* txns, int nb_txns);
     static int mmap_gen(uint32_t mem_address, uint32_t mem_size, volatile uint32_t **return_ptr);
 };
 
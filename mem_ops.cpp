@@ -0,0 +1,263 @@
+
+#include "mem_ops.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+MemOps::MemOps(MemIF* mem, BreakPoints* bp, Loader* loader) {
+  m_mem = mem;
+  m_bp = bp;
+  m_loader = loader;
+
+  m_name = "";
+  m_bytes = 0;
+  m_seconds = 0;
+}
+
+void
+MemOps::start(const char* name) {
+  m_name = name;
+  m_bytes = 0;
+  m_seconds = 0;
+  m_start = std::chrono::steady_clock::now();
+}
+
+void
+MemOps::stop() {
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+// The range must not wrap around the 32 bits address space
+bool
+MemOps::check(uint32_t addr, uint64_t len) {
+  if ((uint64_t)addr + len > 0x100000000ULL) {
+    fprintf(stderr, "MemOps: %llu bytes at 0x%08X go past the end of the address space\n", (unsigned long long)len, addr);
+    return false;
+  }
+
+  return true;
+}
+
+bool
+MemOps::read(uint32_t addr, uint32_t len, char* buffer) {
+  while (len > 0) {
+    uint32_t size = len > MEM_OPS_MAX_ACCESS ? MEM_OPS_MAX_ACCESS : len;
+
+    if (!m_mem->access(0, addr, size, buffer)) {
+      fprintf(stderr, "MemOps: Failed reading %u bytes at 0x%08X\n", size, addr);
+      return false;
+    }
+
+    m_bp->hide(addr, size, buffer);
+    m_bytes += size;
+
+    addr += size;
+    len -= size;
+    buffer += size;
+  }
+
+  return true;
+}
+
+bool
+MemOps::write(uint32_t addr, uint32_t len, char* buffer) {
+  while (len > 0) {
+    uint32_t size = len > MEM_OPS_MAX_ACCESS ? MEM_OPS_MAX_ACCESS : len;
+
+    if (!m_mem->access(1, addr, size, buffer)) {
+      fprintf(stderr, "MemOps: Failed writing %u bytes at 0x%08X\n", size, addr);
+      return false;
+    }
+
+    m_bp->written(addr, size, buffer);
+    m_loader->written(addr, size);
+    m_bytes += size;
+
+    addr += size;
+    len -= size;
+    buffer += size;
+  }
+
+  return true;
+}
+
+bool
+MemOps::dump(uint32_t addr, uint32_t len, const char* path) {
+  this->start("Dumped");
+
+  if (!this->check(addr, len))
+    return false;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    fprintf(stderr, "MemOps: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (len == 0) {
+    close(fd);
+    return true;
+  }
+
+  if (ftruncate(fd, len) == -1) {
+    fprintf(stderr, "MemOps: Unable to resize %s: %s\n", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  char* file = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "MemOps: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // the target data goes straight to the file
+  bool retval = this->read(addr, len, file);
+
+  munmap(file, len);
+  this->stop();
+
+  return retval;
+}
+
+bool
+MemOps::restore(const char* path, uint32_t addr) {
+  struct stat st;
+
+  this->start("Restored");
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "MemOps: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return st.st_size == 0;
+  }
+
+  if (!this->check(addr, st.st_size)) {
+    close(fd);
+    return false;
+  }
+
+  // private, the buffer is only read but MemIF takes a non-const one
+  char* file = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "MemOps: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  bool retval = this->write(addr, st.st_size, file);
+
+  munmap(file, st.st_size);
+  this->stop();
+
+  return retval;
+}
+
+bool
+MemOps::fill(uint32_t addr, uint32_t len, uint32_t pattern) {
+  std::vector<char> buffer(len > MEM_OPS_BURST ? MEM_OPS_BURST : len);
+  bool retval = true;
+
+  this->start("Filled");
+
+  if (!this->check(addr, len))
+    return false;
+
+  // the pattern is repeated from addr, the buffer size is a multiple of it
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = (pattern >> (8 * (i % 4))) & 0xFF;
+  }
+
+  while (len > 0 && retval) {
+    uint32_t burst = len > buffer.size() ? buffer.size() : len;
+
+    retval = this->write(addr, burst, &buffer[0]);
+
+    addr += burst;
+    len -= burst;
+  }
+
+  this->stop();
+
+  return retval;
+}
+
+bool
+MemOps::compare(uint32_t addr, const char* path, uint32_t* differences, uint32_t* first_diff) {
+  struct stat st;
+  bool retval = true;
+
+  this->start("Compared");
+
+  *differences = 0;
+  *first_diff = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "MemOps: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return st.st_size == 0;
+  }
+
+  if (!this->check(addr, st.st_size)) {
+    close(fd);
+    return false;
+  }
+
+  const char* file = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "MemOps: Unable to map %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  uint32_t size = st.st_size;
+  std::vector<char> buffer(size > MEM_OPS_BURST ? MEM_OPS_BURST : size);
+
+  for (uint32_t offset = 0; offset < size && retval; offset += buffer.size()) {
+    uint32_t burst = size - offset > buffer.size() ? buffer.size() : size - offset;
+
+    retval = this->read(addr + offset, burst, &buffer[0]);
+    if (!retval || memcmp(&buffer[0], file + offset, burst) == 0)
+      continue;
+
+    for (uint32_t i = 0; i < burst; i++) {
+      if (buffer[i] != file[offset + i]) {
+        if (*differences == 0)
+          *first_diff = addr + offset + i;
+        (*differences)++;
+      }
+    }
+  }
+
+  munmap((void*)file, st.st_size);
+  this->stop();
+
+  return retval;
+}
+
+void
+MemOps::get_report(char* str, size_t len) {
+  double rate = m_seconds > 0 ? m_bytes / m_seconds / 1e6 : 0;
+
+  snprintf(str, len, "%s %llu bytes in %.3f s (%.2f MB/s)\n", m_name, m_bytes, m_seconds, rate);
+}
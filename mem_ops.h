@@ -0,0 +1,52 @@
+#ifndef MEM_OPS_H
+#define MEM_OPS_H
+
+#include "mem.h"
+#include "breakpoints.h"
+#include "loader.h"
+
+#include <stdint.h>
+#include <chrono>
+
+// Chunk size used when the target data has to go through a bridge buffer
+#define MEM_OPS_BURST 65536
+
+// Largest single access, MemIF takes its size as an int
+#define MEM_OPS_MAX_ACCESS 0x40000000
+
+// Bulk memory operations done within the bridge, each one with as few
+// accesses as possible. Files are accessed through mmap, so that target data
+// is read or written straight from or to them. Reads show the original
+// instructions where breakpoints are set, as gdb would.
+class MemOps {
+  public:
+    MemOps(MemIF* mem, BreakPoints* bp, Loader* loader);
+
+    bool dump(uint32_t addr, uint32_t len, const char* path);
+    bool restore(const char* path, uint32_t addr);
+    bool fill(uint32_t addr, uint32_t len, uint32_t pattern);
+    // differences gets the number of bytes which differ, first_diff the
+    // address of the first one
+    bool compare(uint32_t addr, const char* path, uint32_t* differences, uint32_t* first_diff);
+
+    // Throughput of the last operation
+    void get_report(char* str, size_t len);
+
+  private:
+    bool check(uint32_t addr, uint64_t len);
+    bool read(uint32_t addr, uint32_t len, char* buffer);
+    bool write(uint32_t addr, uint32_t len, char* buffer);
+    void start(const char* name);
+    void stop();
+
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+    Loader* m_loader;
+
+    const char* m_name;
+    unsigned long long m_bytes;
+    std::chrono::steady_clock::time_point m_start;
+    double m_seconds;
+};
+
+#endif
@@ -0,0 +1,223 @@
+
+#include "mem_queue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+static __thread int s_class = MEM_CLASS_AUTO;
+
+static const char* class_names[MEM_CLASS_NB] = { "urgent", "interactive", "bulk" };
+
+MemQueue::MemQueue(MemIF* mem) {
+  m_mem = mem;
+  m_stop = false;
+  this->reset_stats();
+  m_thread = std::thread(&MemQueue::worker, this);
+}
+
+MemQueue::~MemQueue() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond_work.notify_all();
+  m_thread.join();
+}
+
+void
+MemQueue::set_class(enum mem_class cls) {
+  s_class = cls;
+}
+
+void
+MemQueue::worker() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (1) {
+    struct transaction* txn = NULL;
+
+    // highest class first, FIFO inside a class
+    for (int i = 0; i < MEM_CLASS_NB && txn == NULL; i++) {
+      if (!m_queue[i].empty()) {
+        txn = m_queue[i].front();
+        m_queue[i].pop_front();
+      }
+    }
+
+    if (txn == NULL) {
+      if (m_stop)
+        break;
+
+      m_cond_work.wait(lock);
+      continue;
+    }
+
+    unsigned long long wait_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - txn->queued).count();
+    struct class_stats* stats = &m_stats[txn->cls];
+    stats->slices++;
+    stats->wait_us += wait_us;
+    if (wait_us > stats->wait_max_us)
+      stats->wait_max_us = wait_us;
+
+    lock.unlock();
+    bool retval;
+    if (txn->batch)
+      retval = m_mem->access_batch(txn->batch, txn->nb_batch);
+    else
+      retval = m_mem->access(txn->write, txn->addr, txn->size, txn->buffer);
+    lock.lock();
+
+    txn->retval = retval;
+    txn->done = true;
+    m_cond_done.notify_all();
+  }
+}
+
+bool
+MemQueue::submit(struct transaction* txn) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  if (txn->cls == MEM_CLASS_BULK && std::find(m_cancelled.begin(), m_cancelled.end(), txn->owner) != m_cancelled.end())
+    return false;
+
+  txn->done = false;
+  txn->queued = clock::now();
+
+  m_queue[txn->cls].push_back(txn);
+  m_cond_work.notify_one();
+
+  while (!txn->done)
+    m_cond_done.wait(lock);
+
+  return txn->retval;
+}
+
+bool
+MemQueue::access(bool write, unsigned int addr, int size, char* buffer) {
+  struct transaction txn;
+  clock::time_point start = clock::now();
+  int total = size;
+  bool retval = true;
+
+  txn.owner = std::this_thread::get_id();
+  txn.batch = NULL;
+
+  if (s_class != MEM_CLASS_AUTO)
+    txn.cls = (enum mem_class)s_class;
+  else
+    txn.cls = size > MEM_QUEUE_SLICE ? MEM_CLASS_BULK : MEM_CLASS_INTERACTIVE;
+
+  if (txn.cls == MEM_CLASS_BULK) {
+    // a cancel only applies to the transfers in progress
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled.remove(txn.owner);
+  }
+
+  // One slice at a time, other requests get queued in between
+  while (size > 0) {
+    txn.write  = write;
+    txn.addr   = addr;
+    txn.size   = size > MEM_QUEUE_SLICE ? MEM_QUEUE_SLICE : size;
+    txn.buffer = buffer;
+
+    if (!this->submit(&txn)) {
+      retval = false;
+      break;
+    }
+
+    addr   += txn.size;
+    size   -= txn.size;
+    buffer += txn.size;
+  }
+
+  this->account(txn.cls, start, total - size);
+
+  return retval;
+}
+
+bool
+MemQueue::access_batch(struct mem_txn* txns, int nb_txns) {
+  struct transaction txn;
+  clock::time_point start = clock::now();
+  int bytes = 0;
+
+  txn.owner = std::this_thread::get_id();
+  txn.batch = txns;
+  txn.nb_batch = nb_txns;
+  txn.cls = s_class != MEM_CLASS_AUTO ? (enum mem_class)s_class : MEM_CLASS_INTERACTIVE;
+
+  for (int i = 0; i < nb_txns; i++)
+    bytes += txns[i].size;
+
+  bool retval = this->submit(&txn);
+
+  this->account(txn.cls, start, bytes);
+
+  return retval;
+}
+
+void
+MemQueue::account(enum mem_class cls, clock::time_point start, int bytes) {
+  unsigned long long latency_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  struct class_stats* stats = &m_stats[cls];
+  stats->accesses++;
+  stats->bytes += bytes;
+  stats->latency_us += latency_us;
+  if (latency_us > stats->latency_max_us)
+    stats->latency_max_us = latency_us;
+}
+
+void
+MemQueue::cancel(std::thread::id owner) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (std::find(m_cancelled.begin(), m_cancelled.end(), owner) == m_cancelled.end())
+    m_cancelled.push_back(owner);
+
+  // pending slices are completed right away as failed
+  std::list<struct transaction*>* queue = &m_queue[MEM_CLASS_BULK];
+  for (std::list<struct transaction*>::iterator it = queue->begin(); it != queue->end();) {
+    if ((*it)->owner == owner) {
+      (*it)->retval = false;
+      (*it)->done = true;
+      it = queue->erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  m_cond_done.notify_all();
+}
+
+void
+MemQueue::forget(std::thread::id owner) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cancelled.remove(owner);
+}
+
+void
+MemQueue::dump_stats(char* str, size_t len) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t pos;
+
+  pos = snprintf(str, len, "%-12s %10s %12s %10s %10s %10s %10s\n",
+    "class", "accesses", "bytes", "avg us", "max us", "avg wait", "max wait");
+
+  for (int i = 0; i < MEM_CLASS_NB && pos < len; i++) {
+    struct class_stats* stats = &m_stats[i];
+    // wait times are per slice, latencies per access
+    pos += snprintf(&str[pos], len - pos, "%-12s %10llu %12llu %10llu %10llu %10llu %10llu\n",
+      class_names[i], stats->accesses, stats->bytes,
+      stats->accesses ? stats->latency_us / stats->accesses : 0, stats->latency_max_us,
+      stats->slices ? stats->wait_us / stats->slices : 0, stats->wait_max_us);
+  }
+}
+
+void
+MemQueue::reset_stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  memset(m_stats, 0, sizeof(m_stats));
+}
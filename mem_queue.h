@@ -0,0 +1,99 @@
+#ifndef MEM_QUEUE_H
+#define MEM_QUEUE_H
+
+#include "mem.h"
+
+#include <list>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Accesses bigger than this are split into slices, so that more important
+// requests (e.g. halting the cores on a break, or reading registers) can be
+// served in between
+#define MEM_QUEUE_SLICE 4096
+
+// Scheduling classes, from the highest to the lowest priority
+enum mem_class {
+  MEM_CLASS_AUTO = -1,    // bulk if bigger than one slice, interactive otherwise
+  MEM_CLASS_URGENT,       // break handling, jumps ahead of everything else
+  MEM_CLASS_INTERACTIVE,  // gdb requests which someone is waiting for
+  MEM_CLASS_BULK,         // big transfers, can be cancelled
+  MEM_CLASS_NB
+};
+
+// Serializes all accesses to a memory interface through one worker thread,
+// which is the only one to ever touch the underlying interface. Pending
+// transactions are served by class, bulk slices only go out when nothing
+// else is waiting.
+class MemQueue : public MemIF {
+  public:
+    MemQueue(MemIF* mem);
+    ~MemQueue();
+
+    bool access(bool write, unsigned int addr, int size, char* buffer);
+
+    // A batch is not sliced, it goes to the underlying interface in one go and
+    // no other access can come in between
+    bool access_batch(struct mem_txn* txns, int nb_txns);
+
+    // Aborts the bulk transfer currently done by the given thread, as well as
+    // its pending slices. The aborted access returns false.
+    void cancel(std::thread::id owner);
+
+    // Drops the cancel of a thread which is gone, its id may be reused
+    void forget(std::thread::id owner);
+
+    // Class of the accesses done from the calling thread, MEM_CLASS_AUTO by
+    // default
+    static void set_class(enum mem_class cls);
+
+    // Per class latency counters
+    void dump_stats(char* str, size_t len);
+    void reset_stats();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct transaction {
+      bool write;
+      unsigned int addr;
+      int size;
+      char* buffer;
+      struct mem_txn* batch;
+      int nb_batch;
+      enum mem_class cls;
+      std::thread::id owner;
+      clock::time_point queued;
+      bool done;
+      bool retval;
+    };
+
+    struct class_stats {
+      unsigned long long accesses;
+      unsigned long long slices;
+      unsigned long long bytes;
+      unsigned long long latency_us;
+      unsigned long long latency_max_us;
+      unsigned long long wait_us;
+      unsigned long long wait_max_us;
+    };
+
+    void worker();
+    bool submit(struct transaction* txn);
+    void account(enum mem_class cls, clock::time_point start, int bytes);
+
+    MemIF* m_mem;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_work;
+    std::condition_variable m_cond_done;
+    std::list<struct transaction*> m_queue[MEM_CLASS_NB];
+    std::list<std::thread::id> m_cancelled;
+    struct class_stats m_stats[MEM_CLASS_NB];
+    bool m_stop;
+};
+
+#endif
@@ -3,6 +3,17 @@
 #include <sys/file.h>
 #include "mem.h"
 
+bool
+MemIF::access_batch(struct mem_txn* txns, int nb_txns) {
+  bool retval = true;
+
+  for (int i = 0; i < nb_txns; i++) {
+    retval = this->access(txns[i].write, txns[i].addr, txns[i].size, txns[i].buffer) && retval;
+  }
+
+  return retval;
+}
+
 int
 MemIF::mmap_gen(
   uint32_t mem_address,
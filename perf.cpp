@@ -0,0 +1,185 @@
+
+#include "perf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* s_event_names[PERF_NB_EVENTS] = {
+  "cycles", "instr", "ld_stall", "jr_stall", "imiss", "ld", "st", "jump",
+  "branch", "btaken", "rvc", "ld_ext", "st_ext", "ld_ext_cyc", "st_ext_cyc", "tcdm_cont",
+};
+
+// cycles, instr, ld_stall, jr_stall, imiss, ld, st and tcdm_cont
+#define PERF_DEFAULT_EVENTS 0x807F
+
+PerfCounters::PerfCounters(MemIF* mem, std::list<DbgIF*> cores) {
+  m_mem = mem;
+  m_cores = cores;
+  m_events = 0;
+  m_captured = false;
+
+  m_counters.resize(m_cores.size() * PERF_NB_EVENTS);
+}
+
+bool
+PerfCounters::parse_events(const char* str, uint32_t* events) {
+  char buf[256];
+
+  str += strspn(str, " \t");
+  if (*str == '\0') {
+    *events = PERF_DEFAULT_EVENTS;
+    return true;
+  }
+
+  if (strcmp(str, "all") == 0) {
+    *events = (1 << PERF_NB_EVENTS) - 1;
+    return true;
+  }
+
+  snprintf(buf, sizeof(buf), "%s", str);
+  *events = 0;
+
+  char *tok = strtok(buf, " \t,");
+  while (tok != NULL) {
+    int i;
+    for (i = 0; i < PERF_NB_EVENTS; i++) {
+      if (strcmp(tok, s_event_names[i]) == 0)
+        break;
+    }
+
+    if (i == PERF_NB_EVENTS)
+      return false;
+
+    *events |= 1 << i;
+    tok = strtok(NULL, " \t,");
+  }
+
+  return true;
+}
+
+void
+PerfCounters::list_events(char* str, size_t len) {
+  int pos = snprintf(str, len, "Events:");
+
+  for (int i = 0; i < PERF_NB_EVENTS && pos < (int)len; i++) {
+    pos += snprintf(&str[pos], len - pos, " %s", s_event_names[i]);
+  }
+
+  if (pos < (int)len)
+    snprintf(&str[pos], len - pos, "\n");
+}
+
+bool
+PerfCounters::start(uint32_t events) {
+  std::vector<struct mem_txn> txns;
+  uint32_t zero = 0;
+  uint32_t enable = 0x3;
+  // cycles are always counted, for the run accounting
+  uint32_t pcer = events | 1;
+
+  m_events = events;
+  m_captured = false;
+
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++) {
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCMR * 4, &zero));
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCER * 4, &pcer));
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCCR_ALL * 4, &zero));
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCMR * 4, &enable));
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size())) {
+    fprintf(stderr, "Perf: Failed programming the counters\n");
+    return false;
+  }
+
+  return true;
+}
+
+bool
+PerfCounters::stop() {
+  std::vector<struct mem_txn> txns;
+  uint32_t cycles = 1;
+
+  // only the cycles are left, for the run accounting
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++) {
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCER * 4, &cycles));
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCMR * 4, &cycles));
+  }
+
+  return m_mem->access_batch(&txns[0], txns.size());
+}
+
+bool
+PerfCounters::clear() {
+  std::vector<struct mem_txn> txns;
+  uint32_t zero = 0;
+
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++) {
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCCR_ALL * 4, &zero));
+  }
+
+  m_captured = false;
+  return m_mem->access_batch(&txns[0], txns.size());
+}
+
+bool
+PerfCounters::capture() {
+  std::vector<struct mem_txn> txns;
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, i++) {
+    struct mem_txn txn = (*it)->txn(0, 0x4000 + PERF_PCCR * 4, &m_counters[i * PERF_NB_EVENTS]);
+    txn.size = PERF_NB_EVENTS * 4;
+    txns.push_back(txn);
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size())) {
+    fprintf(stderr, "Perf: Failed reading the counters\n");
+    return false;
+  }
+
+  m_captured = true;
+  return true;
+}
+
+void
+PerfCounters::get_report(char* str, size_t len) {
+  std::vector<unsigned long long> total(PERF_NB_EVENTS, 0);
+  int pos = 0;
+
+  if (!m_captured) {
+    snprintf(str, len, "No run since the counters were started\n");
+    return;
+  }
+
+  pos += snprintf(&str[pos], len - pos, "%-6s", "core");
+  for (int j = 0; j < PERF_NB_EVENTS && pos < (int)len; j++) {
+    if (m_events & (1 << j))
+      pos += snprintf(&str[pos], len - pos, " %11s", s_event_names[j]);
+  }
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end() && pos < (int)len; it++, i++) {
+    pos += snprintf(&str[pos], len - pos, "\n%-6X", (*it)->get_thread_id());
+
+    for (int j = 0; j < PERF_NB_EVENTS && pos < (int)len; j++) {
+      if ((m_events & (1 << j)) == 0)
+        continue;
+
+      uint32_t value = m_counters[i * PERF_NB_EVENTS + j];
+      total[j] += value;
+      pos += snprintf(&str[pos], len - pos, " %11u", value);
+    }
+  }
+
+  if (pos < (int)len)
+    pos += snprintf(&str[pos], len - pos, "\n%-6s", "total");
+
+  for (int j = 0; j < PERF_NB_EVENTS && pos < (int)len; j++) {
+    if (m_events & (1 << j))
+      pos += snprintf(&str[pos], len - pos, " %11llu", total[j]);
+  }
+
+  if (pos < (int)len)
+    snprintf(&str[pos], len - pos, "\n");
+}
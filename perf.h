@@ -0,0 +1,54 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "mem.h"
+#include "debug_if.h"
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+
+// RI5CY performance counter CSRs, cf. riscv_cs_registers.sv
+#define PERF_PCCR     0x780  // first counter, one per event
+#define PERF_PCCR_ALL 0x79F  // writes all counters at once
+#define PERF_PCER     0x7A0  // event enable mask
+#define PERF_PCMR     0x7A1  // bit 0: global enable, bit 1: saturate
+
+#define PERF_NB_EVENTS 16
+
+// Counts events on a set of cores over the last run. The counters are
+// programmed once, cleared with one batch when the cores are resumed and read
+// with one batch when they stop, a single access per core as the counters are
+// contiguous in the debug unit.
+//
+// Depending on the configuration of the core, some counters might not be
+// implemented, in which case they read as zero.
+class PerfCounters {
+  public:
+    PerfCounters(MemIF* mem, std::list<DbgIF*> cores);
+
+    // events is a comma separated list of event names, or all
+    static bool parse_events(const char* str, uint32_t* events);
+    static void list_events(char* str, size_t len);
+
+    bool start(uint32_t events);
+    bool stop();
+
+    // The cores are about to be resumed or have just stopped
+    bool clear();
+    bool capture();
+
+    // Table of the counters of each core and their sum
+    void get_report(char* str, size_t len);
+
+  private:
+    MemIF* m_mem;
+    std::list<DbgIF*> m_cores;
+    uint32_t m_events;
+    bool m_captured;
+
+    // PERF_NB_EVENTS counters per core, indexed like m_cores
+    std::vector<uint32_t> m_counters;
+};
+
+#endif
@@ -0,0 +1,443 @@
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HIST_MIN_BUCKETS 1024
+
+// registers read for unwinding, from x1
+#define REG_RA 0
+#define REG_SP 1
+#define REG_S0 7
+#define NB_REGS 8
+
+#define SLICE_WORDS (PROFILER_STACK_SLICE / 4)
+
+Profiler::Profiler(MemIF* mem, std::list<DbgIF*> cores, unsigned int hz, bool stacks) {
+  m_mem = mem;
+  m_cores = cores;
+  m_hz = hz;
+  m_period_us = 1000000 / hz;
+  m_stacks = stacks;
+
+  m_stack_counts.resize(m_cores.size());
+  m_hists.resize(m_cores.size());
+  for (size_t i = 0; i < m_hists.size(); i++) {
+    m_hists[i].buckets.resize(HIST_MIN_BUCKETS);
+    m_hists[i].used = 0;
+    m_hists[i].samples = 0;
+  }
+
+  m_running = false;
+  m_run_seconds = 0;
+  m_halt_seconds = 0;
+  m_halt_max_seconds = 0;
+  m_samples = 0;
+}
+
+// Returns the bucket of pc, or the free one where it should go
+static struct Profiler::bucket*
+probe(std::vector<struct Profiler::bucket>& buckets, uint32_t pc) {
+  size_t mask = buckets.size() - 1;
+  // instructions are at least 2 bytes aligned, mix the address a bit
+  size_t index = ((pc >> 1) * 2654435761u) & mask;
+
+  while (buckets[index].count != 0 && buckets[index].pc != pc) {
+    index = (index + 1) & mask;
+  }
+
+  return &buckets[index];
+}
+
+void
+Profiler::count(struct histogram* hist, uint32_t pc, uint32_t n) {
+  // keep the load under one half, so that probe sequences stay short
+  if ((hist->used + 1) * 2 > hist->buckets.size()) {
+    std::vector<struct bucket> old(hist->buckets.size() * 2);
+    old.swap(hist->buckets);
+
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].count)
+        *probe(hist->buckets, old[i].pc) = old[i];
+    }
+  }
+
+  struct bucket* bucket = probe(hist->buckets, pc);
+  if (bucket->count == 0) {
+    bucket->pc = pc;
+    hist->used++;
+  }
+
+  bucket->count += n;
+  hist->samples += n;
+}
+
+void
+Profiler::run_started() {
+  m_running = false;
+}
+
+bool
+Profiler::sample(std::list<DbgIF*>* cores, DbgIF** stopped) {
+  uint32_t ctrl_halt = 1 << 16;
+  size_t nb_cores = cores->size();
+
+  *stopped = NULL;
+
+  m_hit.resize(nb_cores);
+  m_cause.resize(nb_cores);
+  m_npc.resize(nb_cores);
+  m_regs.resize(nb_cores * NB_REGS);
+  m_slices.resize(nb_cores * SLICE_WORDS);
+  m_txns.clear();
+
+  m_halt_start = clock::now();
+
+  // the other cores of a cluster are halted by the time their registers are
+  // read, the reads go through the link after the halt
+  DbgIF::halt_txns(cores, &m_txns, &ctrl_halt);
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    m_txns.push_back((*it)->txn(0, DBG_HIT_REG, &m_hit[i]));
+    m_txns.push_back((*it)->txn(0, DBG_CAUSE_REG, &m_cause[i]));
+    m_txns.push_back((*it)->txn(0, DBG_NPC_REG, &m_npc[i]));
+
+    if (m_stacks) {
+      struct mem_txn txn = (*it)->txn(0, 0x0404, &m_regs[i * NB_REGS]);
+      txn.size = NB_REGS * 4;
+      m_txns.push_back(txn);
+    }
+  }
+
+  if (!m_mem->access_batch(&m_txns[0], m_txns.size())) {
+    fprintf(stderr, "Profiler: Failed sampling the cores\n");
+    return false;
+  }
+
+  // a core which was already in debug mode keeps its cause, or its HIT
+  // after a step, as send_stop_reason reads them
+  i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    if ((m_hit[i] & 1) || (m_cause[i] & 0x1F) != CAUSE_HALT || (m_cause[i] & (1 << 31))) {
+      *stopped = *it;
+      m_running = false;
+      return true;
+    }
+  }
+
+  return true;
+}
+
+bool
+Profiler::resume(std::list<DbgIF*>* cores) {
+  uint32_t ctrl_cont;
+  uint32_t mask;
+
+  size_t nb_reads = 0;
+  m_txns.clear();
+
+  // the stacks are read before the cores go on modifying them, in the same
+  // batch as the resume
+  if (m_stacks) {
+    for (size_t i = 0; i < cores->size(); i++) {
+      uint32_t sp = m_regs[i * NB_REGS + REG_SP];
+
+      if (sp == 0 || (sp & 3) || sp + PROFILER_STACK_SLICE < sp) {
+        memset(&m_slices[i * SLICE_WORDS], 0, PROFILER_STACK_SLICE);
+        continue;
+      }
+
+      struct mem_txn txn = { false, sp, PROFILER_STACK_SLICE, (char*)&m_slices[i * SLICE_WORDS] };
+      m_txns.push_back(txn);
+      nb_reads++;
+    }
+  }
+
+  DbgIF::resume_txns(cores, &m_txns, &ctrl_cont, &mask);
+
+  bool retval = m_mem->access_batch(&m_txns[0], m_txns.size());
+
+  // sp may point anywhere, the cores must be resumed anyway
+  if (!retval && nb_reads) {
+    memset(&m_slices[0], 0, m_slices.size() * 4);
+    retval = m_mem->access_batch(&m_txns[nb_reads], m_txns.size() - nb_reads);
+  }
+
+  clock::time_point now = clock::now();
+
+  if (!retval) {
+    fprintf(stderr, "Profiler: Failed resuming the cores\n");
+    return false;
+  }
+
+  double halted = std::chrono::duration<double>(now - m_halt_start).count();
+  m_halt_seconds += halted;
+  if (halted > m_halt_max_seconds)
+    m_halt_max_seconds = halted;
+
+  if (m_running)
+    m_run_seconds += std::chrono::duration<double>(now - m_last).count();
+
+  m_running = true;
+  m_last = now;
+  m_samples++;
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    size_t index = 0;
+    for (std::list<DbgIF*>::iterator core = m_cores.begin(); core != m_cores.end(); core++, index++) {
+      if (*core != *it)
+        continue;
+
+      this->count(&m_hists[index], m_npc[i], 1);
+
+      if (m_stacks)
+        this->unwind(index, m_npc[i], &m_regs[i * NB_REGS], &m_slices[i * SLICE_WORDS]);
+    }
+  }
+
+  return true;
+}
+
+void
+Profiler::unwind(size_t core, uint32_t pc, uint32_t* regs, uint32_t* slice) {
+  std::vector<uint32_t> stack;
+  uint32_t sp = regs[REG_SP];
+  uint32_t fp = regs[REG_S0];
+
+  stack.push_back(pc);
+
+  // frames are only followed within the slice which was read, towards the
+  // bottom of the stack
+  while (stack.size() < PROFILER_MAX_DEPTH) {
+    if ((fp & 3) || fp < sp + 8 || fp > sp + PROFILER_STACK_SLICE)
+      break;
+
+    uint32_t ra = slice[(fp - sp) / 4 - 1];
+    uint32_t prev_fp = slice[(fp - sp) / 4 - 2];
+
+    if (ra == 0)
+      break;
+
+    stack.push_back(ra);
+
+    if (prev_fp <= fp)
+      break;
+
+    fp = prev_fp;
+  }
+
+  // no frame pointer, at least show the caller
+  if (stack.size() == 1 && regs[REG_RA] != 0)
+    stack.push_back(regs[REG_RA]);
+
+  m_stack_counts[core][stack]++;
+}
+
+bool
+Profiler::write_pprof(const char* path, std::list<struct histogram*> hists) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Profiler: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // legacy CPU profile, 64 bits slots: header, then one record per PC with
+  // its count, a depth of 1 and the PC, then the trailer
+  uint64_t header[5] = { 0, 3, 0, m_period_us, 0 };
+  fwrite(header, sizeof(header), 1, file);
+
+  for (std::list<struct histogram*>::iterator it = hists.begin(); it != hists.end(); it++) {
+    for (size_t i = 0; i < (*it)->buckets.size(); i++) {
+      if ((*it)->buckets[i].count == 0)
+        continue;
+
+      uint64_t record[3] = { (*it)->buckets[i].count, 1, (*it)->buckets[i].pc };
+      fwrite(record, sizeof(record), 1, file);
+    }
+  }
+
+  uint64_t trailer[3] = { 0, 1, 0 };
+  fwrite(trailer, sizeof(trailer), 1, file);
+
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Profiler: Unable to write %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool
+Profiler::read_symbols(const char* elf) {
+  struct stat st;
+
+  int fd = open(elf, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Profiler: Unable to open %s: %s\n", elf, strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+    fprintf(stderr, "Profiler: %s is not an ELF file\n", elf);
+    close(fd);
+    return false;
+  }
+
+  const char* file = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) {
+    fprintf(stderr, "Profiler: Unable to map %s: %s\n", elf, strerror(errno));
+    return false;
+  }
+
+  const Elf32_Ehdr* ehdr = (const Elf32_Ehdr*)file;
+  bool valid = memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 && ehdr->e_ident[EI_CLASS] == ELFCLASS32 &&
+    ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr) <= (size_t)st.st_size;
+
+  if (!valid) {
+    fprintf(stderr, "Profiler: %s is not a 32 bits ELF file\n", elf);
+    munmap((void*)file, st.st_size);
+    return false;
+  }
+
+  const Elf32_Shdr* shdrs = (const Elf32_Shdr*)(file + ehdr->e_shoff);
+
+  for (int i = 0; i < ehdr->e_shnum; i++) {
+    if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+      continue;
+
+    const Elf32_Shdr* strtab = &shdrs[shdrs[i].sh_link];
+    if (shdrs[i].sh_offset + shdrs[i].sh_size > (size_t)st.st_size ||
+        strtab->sh_offset + strtab->sh_size > (size_t)st.st_size)
+      continue;
+
+    const Elf32_Sym* syms = (const Elf32_Sym*)(file + shdrs[i].sh_offset);
+    size_t nb_syms = shdrs[i].sh_size / sizeof(Elf32_Sym);
+
+    for (size_t j = 0; j < nb_syms; j++) {
+      if (ELF32_ST_TYPE(syms[j].st_info) != STT_FUNC || syms[j].st_name >= strtab->sh_size)
+        continue;
+
+      const char* name = file + strtab->sh_offset + syms[j].st_name;
+      struct symbol symbol = { syms[j].st_size, std::string(name, strnlen(name, strtab->sh_size - syms[j].st_name)) };
+      m_symbols[syms[j].st_value] = symbol;
+    }
+  }
+
+  munmap((void*)file, st.st_size);
+  return true;
+}
+
+void
+Profiler::symbolize(uint32_t addr, char* str, size_t len) {
+  std::map<uint32_t, struct symbol>::iterator it = m_symbols.upper_bound(addr);
+
+  if (it != m_symbols.begin()) {
+    it--;
+    if (addr - it->first < it->second.size) {
+      snprintf(str, len, "%s", it->second.name.c_str());
+      return;
+    }
+  }
+
+  snprintf(str, len, "0x%08x", addr);
+}
+
+bool
+Profiler::write_folded(const char* path, const char* elf) {
+  if (elf && !this->read_symbols(elf))
+    return false;
+
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Profiler: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  // one line per stack, from the root to the leaf, followed by its count
+  size_t core = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, core++) {
+    std::map<std::vector<uint32_t>, unsigned long long>& counts = m_stack_counts[core];
+
+    for (std::map<std::vector<uint32_t>, unsigned long long>::iterator stack = counts.begin(); stack != counts.end(); stack++) {
+      fprintf(file, "core_%X", (*it)->get_thread_id());
+
+      for (size_t i = stack->first.size(); i > 0; i--) {
+        char name[256];
+        // return addresses point after the call
+        uint32_t addr = stack->first[i - 1] - (i > 1 ? 1 : 0);
+
+        this->symbolize(addr, name, sizeof(name));
+        fprintf(file, ";%s", name);
+      }
+
+      fprintf(file, " %llu\n", stack->second);
+    }
+  }
+
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Profiler: Unable to write %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool
+Profiler::write(const char* path, const char* elf) {
+  std::list<struct histogram*> all;
+
+  if (m_stacks)
+    return this->write_folded(path, elf);
+
+  for (size_t i = 0; i < m_hists.size(); i++) {
+    all.push_back(&m_hists[i]);
+  }
+
+  if (!this->write_pprof(path, all))
+    return false;
+
+  if (m_cores.size() == 1)
+    return true;
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, i++) {
+    std::list<struct histogram*> one;
+    char core_path[1024];
+
+    one.push_back(&m_hists[i]);
+    snprintf(core_path, sizeof(core_path), "%s.%X", path, (*it)->get_thread_id());
+
+    if (!this->write_pprof(core_path, one))
+      return false;
+  }
+
+  return true;
+}
+
+void
+Profiler::get_report(char* str, size_t len) {
+  double rate = m_run_seconds > 0 ? m_samples / m_run_seconds : 0;
+  double overhead = m_run_seconds > 0 ? m_halt_seconds / m_run_seconds * 100 : 0;
+  double halt_avg = m_samples ? m_halt_seconds / m_samples : 0;
+  int pos;
+
+  pos = snprintf(str, len, "%llu samples at %.1f Hz (%u Hz requested), cores halted %.1f us on average, %.1f us at most, %.2f%% of the time\n",
+    m_samples, rate, m_hz, halt_avg * 1e6, m_halt_max_seconds * 1e6, overhead);
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end() && pos < (int)len; it++, i++) {
+    pos += snprintf(&str[pos], len - pos, "  core %X: %llu samples, %u distinct PCs\n",
+      (*it)->get_thread_id(), m_hists[i].samples, m_hists[i].used);
+  }
+}
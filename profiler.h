@@ -0,0 +1,116 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "mem.h"
+#include "debug_if.h"
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+
+// Highest supported sampling frequency, a sample costs two batches
+#define PROFILER_MAX_HZ 10000
+
+// Bytes of stack read above sp to unwind, and maximum number of frames
+#define PROFILER_STACK_SLICE 1024
+#define PROFILER_MAX_DEPTH   64
+
+// Statistical PC sampling of running cores. The debug unit only gives access
+// to the PC of halted cores, thus a sample halts the cores, reads their NPC
+// and resumes them, with one batch each way so that the cores are stopped for
+// as short as possible. The cluster being in all-stop mode, it is halted
+// through one of its cores and resumed through the cluster controller.
+//
+// The PCs are counted per core in an open-addressing hash table and written
+// out as a legacy pprof CPU profile, e.g. for pprof --text app.elf prof.out
+//
+// With stacks, the halting batch also reads ra, sp and s0, and a slice of the
+// stack of each core is read at the start of the resuming batch. Call stacks
+// are unwound through the frame pointers (ra at s0-4, the previous s0 at
+// s0-8), which requires the code to be built with -fno-omit-frame-pointer,
+// and written out as folded stacks for flame graphs.
+class Profiler {
+  public:
+    Profiler(MemIF* mem, std::list<DbgIF*> cores, unsigned int hz, bool stacks=false);
+
+    unsigned int get_period_us() { return m_period_us; }
+
+    // The cores were resumed, the time until the next sample is not counted
+    // in the sampling rate if they stopped in between
+    void run_started();
+
+    // Halts the given cores and records their PC. If one of them had stopped
+    // on its own (e.g. on a breakpoint or after a step), stopped points to it
+    // and the cores must not be resumed.
+    bool sample(std::list<DbgIF*>* cores, DbgIF** stopped);
+    bool resume(std::list<DbgIF*>* cores);
+
+    // Writes all samples to path and, when there are several cores, the
+    // samples of each core to path.<thread id>. Folded stacks are written to
+    // path only, with one root frame per core, and the symbols of elf if given.
+    bool write(const char* path, const char* elf=NULL);
+
+    // Sample counts, achieved rate and time the cores spent halted
+    void get_report(char* str, size_t len);
+
+    struct bucket {
+      uint32_t pc;
+      uint32_t count;  // 0 for a free bucket
+    };
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct histogram {
+      std::vector<struct bucket> buckets;
+      unsigned int used;
+      unsigned long long samples;
+    };
+
+    struct symbol {
+      uint32_t size;
+      std::string name;
+    };
+
+    void count(struct histogram* hist, uint32_t pc, uint32_t n);
+    void unwind(size_t core, uint32_t pc, uint32_t* regs, uint32_t* slice);
+    bool write_pprof(const char* path, std::list<struct histogram*> hists);
+    bool write_folded(const char* path, const char* elf);
+    bool read_symbols(const char* elf);
+    void symbolize(uint32_t addr, char* str, size_t len);
+
+    MemIF* m_mem;
+    std::list<DbgIF*> m_cores;
+    unsigned int m_hz;
+    unsigned int m_period_us;
+    bool m_stacks;
+
+    // indexed like m_cores
+    std::vector<struct histogram> m_hists;
+    std::vector<std::map<std::vector<uint32_t>, unsigned long long> > m_stack_counts;
+
+    // function symbols by start address, only loaded to write folded stacks
+    std::map<uint32_t, struct symbol> m_symbols;
+
+    // per sample buffers, kept to avoid allocations while the cores are halted
+    std::vector<struct mem_txn> m_txns;
+    std::vector<uint32_t> m_hit;
+    std::vector<uint32_t> m_cause;
+    std::vector<uint32_t> m_npc;
+    // x1 to x8 of each core, and its stack slice
+    std::vector<uint32_t> m_regs;
+    std::vector<uint32_t> m_slices;
+
+    bool m_running;
+    clock::time_point m_last;
+    clock::time_point m_halt_start;
+    double m_run_seconds;
+    double m_halt_seconds;
+    double m_halt_max_seconds;
+    unsigned long long m_samples;
+};
+
+#endif
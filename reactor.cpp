@@ -0,0 +1,86 @@
+
+#include "reactor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+
+#define REACTOR_MAX_EVENTS 16
+
+Reactor::Reactor() {
+  m_running = false;
+
+  m_epoll_fd = epoll_create(REACTOR_MAX_EVENTS);
+  if (m_epoll_fd == -1)
+    fprintf(stderr, "Unable to create epoll instance: %s\n", strerror(errno));
+}
+
+Reactor::~Reactor() {
+  if (m_epoll_fd != -1)
+    ::close(m_epoll_fd);
+}
+
+bool
+Reactor::add(EventHandler* handler) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = handler;
+
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, handler->get_fd(), &ev) == -1) {
+    fprintf(stderr, "Unable to add fd %d to reactor: %s\n", handler->get_fd(), strerror(errno));
+    return false;
+  }
+
+  m_handlers.push_back(handler);
+  return true;
+}
+
+void
+Reactor::remove(EventHandler* handler) {
+  std::list<EventHandler*>::iterator it = std::find(m_handlers.begin(), m_handlers.end(), handler);
+  if (it == m_handlers.end())
+    return;
+
+  m_handlers.erase(it);
+
+  // the fd might already be closed, in which case epoll has dropped it already
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, handler->get_fd(), NULL);
+
+  handler->closed();
+}
+
+void
+Reactor::loop() {
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  m_running = true;
+
+  while (m_running && !m_handlers.empty()) {
+    int n = epoll_wait(m_epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "Reactor: epoll_wait failed: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      EventHandler* handler = (EventHandler*)events[i].data.ptr;
+
+      // an earlier event of this round might have removed the handler
+      if (std::find(m_handlers.begin(), m_handlers.end(), handler) == m_handlers.end())
+        continue;
+
+      if (!handler->readable())
+        this->remove(handler);
+    }
+  }
+
+  m_running = false;
+}
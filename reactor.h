@@ -0,0 +1,37 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <list>
+
+class EventHandler {
+  public:
+    virtual ~EventHandler(){};
+
+    virtual int get_fd() = 0;
+
+    // Called when the file descriptor is readable. Returning false removes the
+    // handler from the reactor, after which closed() is called.
+    virtual bool readable() = 0;
+
+    // Last call the reactor does on this handler, it may be deleted from here
+    virtual void closed() {}
+};
+
+class Reactor {
+  public:
+    Reactor();
+    ~Reactor();
+
+    bool add(EventHandler* handler);
+    void remove(EventHandler* handler);
+
+    void loop();
+    void stop() { m_running = false; }
+
+  private:
+    int m_epoll_fd;
+    bool m_running;
+    std::list<EventHandler*> m_handlers;
+};
+
+#endif
@@ -0,0 +1,349 @@
+
+#include "record.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+// Where an instruction stores and how many bytes, false if it does not store
+static bool
+store_access(uint32_t insn, const uint32_t* regs, uint32_t* addr, unsigned int* size) {
+  // compressed, c.sw and c.swsp, c.fsw and c.fswsp
+  if ((insn & 0x3) != 0x3) {
+    uint32_t funct3 = (insn >> 13) & 0x7;
+
+    if ((insn & 0x3) == 0x0 && (funct3 == 6 || funct3 == 7)) {
+      uint32_t imm = ((insn >> 10) & 0x7) << 3 | ((insn >> 6) & 0x1) << 2 | ((insn >> 5) & 0x1) << 6;
+      *addr = regs[8 + ((insn >> 7) & 0x7)] + imm;
+      *size = 4;
+      return true;
+    }
+
+    if ((insn & 0x3) == 0x2 && (funct3 == 6 || funct3 == 7)) {
+      uint32_t imm = ((insn >> 9) & 0xF) << 2 | ((insn >> 7) & 0x3) << 6;
+      *addr = regs[2] + imm;
+      *size = 4;
+      return true;
+    }
+
+    return false;
+  }
+
+  uint32_t opcode = insn & 0x7F;
+  uint32_t funct3 = (insn >> 12) & 0x7;
+  uint32_t rs1 = regs[(insn >> 15) & 0x1F];
+
+  if ((opcode == 0x23 && funct3 <= 2) || (opcode == 0x27 && funct3 == 2)) {
+    // sb, sh, sw and fsw
+    int32_t imm = ((int32_t)(insn & 0xFE000000) >> 20) | ((insn >> 7) & 0x1F);
+    *addr = rs1 + imm;
+    *size = 1 << funct3;
+    return true;
+  }
+
+  if (opcode == 0x23 && funct3 >= 4 && funct3 <= 6) {
+    // RI5CY register offset, p.sw rs2, rs3(rs1), rs3 being where the immediate
+    // usually is
+    *addr = rs1 + regs[(insn >> 7) & 0x1F];
+    *size = 1 << (funct3 & 0x3);
+    return true;
+  }
+
+  if (opcode == 0x2B && (funct3 & 0x3) <= 2) {
+    // RI5CY post-increment, the address is rs1 before the increment
+    *addr = rs1;
+    *size = 1 << (funct3 & 0x3);
+    return true;
+  }
+
+  return false;
+}
+
+Record::Record(MemIF* mem, BreakPoints* bp, size_t size) {
+  m_mem = mem;
+  m_bp = bp;
+  m_max = std::max(size / sizeof(struct record_entry), (size_t)1);
+  m_first = 0;
+  m_count = 0;
+  m_dropped = 0;
+  m_dbgif = NULL;
+  m_pc = 0;
+  memset(m_regs, 0, sizeof(m_regs));
+  m_started = false;
+  m_steps = 0;
+  m_seconds = 0;
+}
+
+Record::~Record() {
+  this->finish();
+}
+
+void
+Record::drop() {
+  // undoing across the instruction would give a state which never existed
+  m_first = 0;
+  m_count = 0;
+}
+
+void
+Record::push(struct record_entry* entry) {
+  size_t pos = (m_first + m_count) % m_max;
+
+  if (m_count == m_max) {
+    m_entries[pos] = *entry;
+    m_first = (m_first + 1) % m_max;
+    m_dropped++;
+    return;
+  }
+
+  if (pos == m_entries.size()) {
+    // grows as a vector would, without going over the size of the log
+    if (m_entries.size() == m_entries.capacity())
+      m_entries.reserve(std::min(m_max, std::max(m_entries.size() * 2, (size_t)1024)));
+
+    m_entries.push_back(*entry);
+  } else {
+    m_entries[pos] = *entry;
+  }
+
+  m_count++;
+}
+
+struct record_entry*
+Record::pop() {
+  m_count--;
+  return &m_entries[(m_first + m_count) % m_max];
+}
+
+bool
+Record::start(DbgIF* dbgif, uint32_t pc) {
+  if (dbgif != m_dbgif) {
+    m_entries.clear();
+    m_first = 0;
+    m_count = 0;
+    m_dbgif = dbgif;
+  }
+
+  // gdb may have changed the code since the last run
+  m_insns.clear();
+  m_bp->commit();
+
+  struct mem_txn txns[2] = {
+    dbgif->txn(1, DBG_NPC_REG, &pc),
+    dbgif->txn(0, 0x0400 + 4, &m_regs[1]),
+  };
+  txns[1].size = 31 * 4;
+
+  if (!m_mem->access_batch(txns, 2))
+    return false;
+
+  m_regs[0] = 0;
+  m_pc = pc;
+  m_started = true;
+  m_start = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool
+Record::step(bool* stopped) {
+  struct record_entry entry;
+  struct mem_txn txns[6];
+  int nb_txns = 0;
+  uint32_t hit = 0;
+  uint32_t ctrl_step = 0x1;
+  uint32_t status[2];  // CTRL and HIT
+  uint32_t npc;
+  uint32_t regs[32];
+  uint32_t insn;
+  uint32_t addr;
+  unsigned int size;
+
+  *stopped = false;
+
+  // a breakpoint which is about to be executed stays out of memory until the
+  // end of the run
+  if (m_bp->at_addr(m_pc) && m_disabled.insert(m_pc).second) {
+    m_bp->disable(m_pc);
+    m_bp->commit();
+  }
+
+  std::unordered_map<uint32_t, uint32_t>::iterator it = m_insns.find(m_pc);
+  if (it != m_insns.end()) {
+    insn = it->second;
+  } else {
+    if (!m_mem->access(0, m_pc, 4, (char*)&insn))
+      return false;
+
+    m_bp->hide(m_pc, 4, (char*)&insn);
+    m_insns[m_pc] = insn;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.pc = m_pc;
+
+  // what the instruction is about to overwrite
+  if (store_access(insn, m_regs, &addr, &size)) {
+    entry.mem_addr = addr;
+    entry.mem_size = size;
+
+    struct mem_txn txn = { false, addr, (int)size, (char*)&entry.mem_old };
+    txns[nb_txns++] = txn;
+  }
+
+  txns[nb_txns++] = m_dbgif->txn(1, DBG_HIT_REG, &hit);
+  txns[nb_txns++] = m_dbgif->txn(1, DBG_CTRL_REG, &ctrl_step);
+
+  struct mem_txn* status_txn = &txns[nb_txns];
+  txns[nb_txns] = m_dbgif->txn(0, DBG_CTRL_REG, status);
+  txns[nb_txns++].size = 2 * 4;
+  txns[nb_txns++] = m_dbgif->txn(0, DBG_NPC_REG, &npc);
+  txns[nb_txns] = m_dbgif->txn(0, 0x0400 + 4, &regs[1]);
+  txns[nb_txns++].size = 31 * 4;
+
+  // the core may have stepped, the instruction is then lost
+  if (!m_mem->access_batch(txns, nb_txns)) {
+    this->drop();
+    return false;
+  }
+
+  // the step is usually over by the time CTRL is read
+  if (!(status[0] & (1 << 16))) {
+    std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(RECORD_STEP_TIMEOUT_MS);
+
+    while (!(status[0] & (1 << 16)) && std::chrono::steady_clock::now() < timeout) {
+      if (!m_mem->access_batch(status_txn, 1)) {
+        this->drop();
+        return false;
+      }
+    }
+
+    if (!(status[0] & (1 << 16)) || !m_mem->access_batch(status_txn + 1, 2)) {
+      fprintf(stderr, "Record: Core did not halt after a step at 0x%08x, the log is dropped\n", m_pc);
+      this->drop();
+      return false;
+    }
+  }
+
+  // e.g. an exception which enters debug mode
+  if (!(status[1] & 1)) {
+    *stopped = true;
+    return true;
+  }
+
+  regs[0] = 0;
+  for (int i = 1; i < 32; i++) {
+    if (regs[i] == m_regs[i])
+      continue;
+
+    // only the RI5CY post-increment loads change two
+    if (entry.nb_regs == 2) {
+      fprintf(stderr, "Record: Instruction at 0x%08x changed more than 2 registers, the log is dropped\n", m_pc);
+      memcpy(m_regs, regs, sizeof(regs));
+      m_pc = npc;
+      this->drop();
+      return false;
+    }
+
+    entry.reg_idx[entry.nb_regs] = i;
+    entry.reg_old[entry.nb_regs++] = m_regs[i];
+  }
+
+  memcpy(m_regs, regs, sizeof(regs));
+  m_pc = npc;
+
+  this->push(&entry);
+  m_steps++;
+  return true;
+}
+
+bool
+Record::finish() {
+  if (!m_started)
+    return true;
+
+  m_started = false;
+  m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+
+  if (m_disabled.empty())
+    return true;
+
+  for (std::set<unsigned int>::iterator it = m_disabled.begin(); it != m_disabled.end(); it++)
+    m_bp->enable(*it);
+  m_disabled.clear();
+
+  return m_bp->commit();
+}
+
+bool
+Record::undo(DbgIF* dbgif, bool to_breakpoint, bool* begin) {
+  std::vector<struct mem_txn> txns;
+  uint32_t regs[32];
+  uint32_t pc;
+
+  *begin = false;
+
+  if (dbgif != m_dbgif || m_count == 0) {
+    *begin = true;
+    return true;
+  }
+
+  struct mem_txn txn = dbgif->txn(0, 0x0400 + 4, &regs[1]);
+  txn.size = 31 * 4;
+  if (!m_mem->access_batch(&txn, 1))
+    return false;
+
+  // The entries are undone from the newest one, only the oldest value of each
+  // register is written, while the stores are reverted in order, all of them
+  // in one batch. The entries stay in place until the next step, so the old
+  // values are written from the log itself.
+  do {
+    struct record_entry* entry = this->pop();
+
+    for (int i = 0; i < entry->nb_regs; i++)
+      regs[entry->reg_idx[i]] = entry->reg_old[i];
+
+    if (entry->mem_size) {
+      struct mem_txn store = { true, entry->mem_addr, entry->mem_size, (char*)&entry->mem_old };
+      txns.push_back(store);
+      m_bp->written(entry->mem_addr, entry->mem_size, (char*)&entry->mem_old);
+    }
+
+    pc = entry->pc;
+  } while (to_breakpoint && m_count && !m_bp->at_addr(pc));
+
+  // back to the start of the log without meeting a breakpoint
+  if (to_breakpoint && !m_bp->at_addr(pc))
+    *begin = true;
+
+  bool stores = !txns.empty();
+
+  txn = dbgif->txn(1, 0x0400 + 4, &regs[1]);
+  txn.size = 31 * 4;
+  txns.push_back(txn);
+  txns.push_back(dbgif->txn(1, DBG_NPC_REG, &pc));
+
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  m_pc = pc;
+
+  // breakpoints stored over are written again, with the cache flush
+  return !stores || m_bp->commit();
+}
+
+void
+Record::get_report(char* str, size_t len) {
+  double rate = m_seconds > 0 ? m_steps / m_seconds : 0;
+
+  if (m_dbgif == NULL) {
+    snprintf(str, len, "Recording, nothing logged yet, %u KB of log\n",
+      (unsigned int)(m_max * sizeof(struct record_entry) / 1024));
+    return;
+  }
+
+  snprintf(str, len, "Recording core %u: %u instructions in the log (%u of %u KB), %llu dropped, %llu steps in %.3f s (%.0f steps/s)\n",
+    m_dbgif->get_thread_id(), (unsigned int)m_count,
+    (unsigned int)(m_count * sizeof(struct record_entry) / 1024),
+    (unsigned int)(m_max * sizeof(struct record_entry) / 1024),
+    m_dropped, m_steps, m_seconds, rate);
+}
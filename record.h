@@ -0,0 +1,103 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "mem.h"
+#include "debug_if.h"
+#include "breakpoints.h"
+
+#include <stdint.h>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <chrono>
+
+// Size of the log in MB, by default and at most
+#define RECORD_DEFAULT_MB 16
+#define RECORD_MAX_MB     1024
+
+// Time in ms given to a core to do one step
+#define RECORD_STEP_TIMEOUT_MS 1000
+
+// What one instruction changed, with the values from before it
+struct record_entry {
+  uint32_t pc;
+  uint32_t reg_old[2];
+  uint32_t mem_addr;
+  uint32_t mem_old;
+  uint8_t reg_idx[2];
+  uint8_t nb_regs;
+  uint8_t mem_size;  // 0 if the instruction did not store
+};
+
+// Execution log of one core, for reverse execution. The bridge single-steps
+// the core and logs, for each instruction, its PC, the general purpose
+// registers it changed and the memory it stored to. A step is one batch: read
+// the memory about to be stored to, clear HIT, step through CTRL, read CTRL
+// and HIT, NPC and the registers. The registers which changed are found by
+// comparing them with the previous step, the store by decoding the
+// instruction (RV32I, RVC, F and the RI5CY register offset and
+// post-increment stores).
+//
+// The entries have a fixed size and are kept in an arena of at most the
+// given size, the oldest entries are dropped once it is full. A step which
+// could not be logged, e.g. after a failed access, drops the whole log, so
+// that the history never has a gap. CSRs, floating point registers, and
+// memory written by something else than a store of the core, e.g. a DMA, are
+// not logged.
+class Record {
+  public:
+    Record(MemIF* mem, BreakPoints* bp, size_t size);
+    ~Record();
+
+    // Start of a recorded run, pc is where the core is stopped. The log is
+    // restarted if it was recorded on another core.
+    bool start(DbgIF* dbgif, uint32_t pc);
+
+    // Executes and logs one instruction. stopped is set when the core halted
+    // for another reason than the step, the instruction is then not logged.
+    bool step(bool* stopped);
+
+    // PC of the next instruction
+    uint32_t get_pc() { return m_pc; }
+
+    // End of a recorded run, puts back the breakpoints which were executed
+    bool finish();
+
+    // Restores the state from before the last instruction, or from before
+    // the previous instructions up to a breakpoint. begin is set when the
+    // start of the log is reached.
+    bool undo(DbgIF* dbgif, bool to_breakpoint, bool* begin);
+
+    // Size of the log and achieved recording rate
+    void get_report(char* str, size_t len);
+
+  private:
+    void drop();
+    void push(struct record_entry* entry);
+    struct record_entry* pop();
+
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+
+    // ring of at most m_max entries, allocated as it fills up
+    std::vector<struct record_entry> m_entries;
+    size_t m_max;
+    size_t m_first;
+    size_t m_count;
+    unsigned long long m_dropped;
+
+    DbgIF* m_dbgif;
+    uint32_t m_pc;
+    uint32_t m_regs[32];
+    // instructions read so far in this run, with the breakpoints hidden
+    std::unordered_map<uint32_t, uint32_t> m_insns;
+    // breakpoints taken out of memory until the end of the run
+    std::set<unsigned int> m_disabled;
+
+    bool m_started;
+    std::chrono::steady_clock::time_point m_start;
+    unsigned long long m_steps;
+    double m_seconds;
+};
+
+#endif
@@ -1,5 +1,19 @@
 #include <inttypes.h>
+#include <stdarg.h>
+#include <algorithm>
 #include "rsp.h"
+#include "rsp_server.h"
+#include "loader.h"
+#include "mem_ops.h"
+#include "checkpoint.h"
+#include "profiler.h"
+#include "perf.h"
+#include "run_stats.h"
+#include "semihost.h"
+#include "watch.h"
+#include "coverage.h"
+#include "trace.h"
+#include "record.h"
 
 enum mp_type {
   BP_MEMORY   = 0,
@@ -9,110 +23,583 @@ enum mp_type {
   WP_ACCESS   = 4
 };
 
-// Cf. riscv_defines.sv and riscv_controller.sv (and RISCV debug draft 0.4)
-enum debug_causes {
-  CAUSE_ILLEGAL_INSN = 0x02, // Illegal instruction
-  CAUSE_BREAKPOINT   = 0x03, // Break point
-  CAUSE_ECALL_UMODE  = 0x08, // ECALL from User Mode
-  CAUSE_ECALL_MMODE  = 0x0B, // ECALL from Machine Mode
-};
-
-#define PACKET_MAX_LEN 4096
-
-Rsp::Rsp(int socket_port, MemIF* mem, LogIF *log, std::list<DbgIF*> list_dbgif, BreakPoints* bp) {
-  m_socket_port = socket_port;
+Rsp::Rsp(RspServer* server, Transport* transport, MemQueue* mem, LogIF *log, BreakPoints* bp) {
+  m_server = server;
+  m_transport = transport;
   m_mem = mem;
-  m_dbgifs = list_dbgif;
   m_bp = bp;
   this->log = log;
 
-  // select one dbg if at random
-  if (m_dbgifs.size() == 0) {
-    fprintf(stderr, "No debug interface available! Exiting now\n");
-    exit(1);
+  m_rx_len = 0;
+  m_tx_last = NULL;
+  m_tx_last_len = 0;
+  m_break = false;
+  m_stop = false;
+  m_running = false;
+  m_wait_dbgif = NULL;
+  m_stepping = false;
+  m_thread_sel = 0;
+  m_profiler = NULL;
+  m_perf = NULL;
+  m_run_stats = new RunStats(mem);
+  m_semihost = NULL;
+  m_watch = new Watch(mem);
+  m_coverage = NULL;
+  m_record = NULL;
+}
+
+Rsp::~Rsp() {
+  if (m_thread.joinable()) {
+    std::thread::id id = m_thread.get_id();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_one();
+    m_mem->cancel(id);
+    m_thread.join();
+    m_mem->forget(id);
+  }
+
+  for (std::list<struct rsp_packet>::iterator it = m_packets.begin(); it != m_packets.end(); it++) {
+    free(it->data);
+  }
+
+  // coverage breakpoints are removed with the others, as well as the ones
+  // taken out by a recorded run
+  delete m_coverage;
+  delete m_record;
+
+  // only drop our own breakpoints, other clients might still rely on theirs
+  for (std::multiset<unsigned int>::iterator it = m_bp_addrs.begin(); it != m_bp_addrs.end(); it++) {
+    m_bp->remove(*it);
+  }
+  m_bp->commit();
+
+  delete m_profiler;
+  delete m_perf;
+  delete m_run_stats;
+  delete m_semihost;
+  delete m_watch;
+  free(m_tx_last);
+  delete m_transport;
+}
+
+void
+Rsp::set_cores(std::list<DbgIF*> list_dbgif) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dbgifs = list_dbgif;
+  }
+
+  m_dbgif_by_tid.clear();
+  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+    unsigned int thread_id = (*it)->get_thread_id();
+    if (thread_id >= m_dbgif_by_tid.size())
+      m_dbgif_by_tid.resize(thread_id + 1, NULL);
+
+    m_dbgif_by_tid[thread_id] = *it;
   }
 
+  m_run_stats->set_cores(m_dbgifs);
+
+  // select one dbg if at random
   m_thread_sel = m_dbgifs.front()->get_thread_id();
+
+  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+    if (!(*it)->halt()) {
+      printf("ERROR: failed sending halt\n");
+    }
+  }
+}
+
+void
+Rsp::start() {
+  m_thread = std::thread(&Rsp::run, this);
+}
+
+void
+Rsp::closed() {
+  log->debug("RSP: Client disconnected\n");
+  m_server->release(this);
 }
 
 bool
-Rsp::open() {
-  struct sockaddr_in addr;
-  int yes = 1;
-  bool ret = 0;
-
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(m_socket_port);
-  addr.sin_addr.s_addr = INADDR_ANY;
-  memset(addr.sin_zero, '\0', sizeof(addr.sin_zero));
-
-  m_socket_in = socket(PF_INET, SOCK_STREAM, 0);
-  if(m_socket_in < 0)
-  {
-    fprintf(stderr, "Unable to create comm socket: %s\n", strerror(errno));
+Rsp::readable() {
+  char pkt[PACKET_MAX_LEN];
+  size_t len;
+  int ret;
+
+  ret = m_transport->read(&m_rx_buf[m_rx_len], sizeof(m_rx_buf) - m_rx_len);
+
+  if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
+    fprintf(stderr, "RSP: Error receiving data: %s\n",
+            ret == 0 ? "Connection reset by peer" : strerror(errno));
     return false;
   }
 
-  if(setsockopt(m_socket_in, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-    fprintf(stderr, "Unable to setsockopt on the socket: %s\n", strerror(errno));
-    return false;
+  if (ret == -1) {
+    // no data available
+    return true;
   }
 
-  if(bind(m_socket_in, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-    fprintf(stderr, "Unable to bind the socket: %s\n", strerror(errno));
-    return false;
+  m_rx_len += ret;
+
+  while ((ret = this->get_packet(pkt, &len)) > 0) {
+    if (pkt[0] == 0x03 && len == 1) {
+      this->interrupt();
+      continue;
+    }
+
+    struct rsp_packet packet;
+    packet.data = (char*)malloc(len + 1);
+    packet.len = len;
+    memcpy(packet.data, pkt, len + 1);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_packets.push_back(packet);
+    }
+    m_cond.notify_one();
   }
 
-  if(listen(m_socket_in, 1) == -1) {
-    fprintf(stderr, "Unable to listen: %s\n", strerror(errno));
-    return false;
+  return ret == 0;
+}
+
+void
+Rsp::interrupt() {
+  std::list<DbgIF*> dbgifs;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_break = true;
+    dbgifs = m_dbgifs;
   }
 
-  fprintf(stderr, "Debug bridge listening on port %d\n", m_socket_port);
+  // Drop whatever bulk transfer the session is doing and stop the cores
+  // ahead of all other pending target accesses. The session thread then
+  // reports the stop to gdb.
+  m_mem->cancel(m_thread.get_id());
 
-  // now clear resources
-  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+  MemQueue::set_class(MEM_CLASS_URGENT);
+  for (std::list<DbgIF*>::iterator it = dbgifs.begin(); it != dbgifs.end(); it++) {
     if (!(*it)->halt()) {
       printf("ERROR: failed sending halt\n");
-      ret = 1;
     }
   }
+  MemQueue::set_class(MEM_CLASS_AUTO);
 
-  return ret;
+  m_cond.notify_one();
 }
 
 void
-Rsp::close() {
-  m_bp->clear();
-  ::close(m_socket_in);
+Rsp::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (!m_stop) {
+    bool retval = true;
+
+    if (m_break) {
+      m_break = false;
+      lock.unlock();
+      retval = this->ctrlc();
+      lock.lock();
+    } else if (!m_packets.empty()) {
+      struct rsp_packet packet = m_packets.front();
+      m_packets.pop_front();
+
+      lock.unlock();
+      log->debug("Received $%.*s\n", packet.len, packet.data);
+      retval = this->decode(packet.data, packet.len);
+      free(packet.data);
+      lock.lock();
+    } else if (m_running) {
+      lock.unlock();
+      if (m_record)
+        retval = this->record_steps();
+      else if (m_profiler && !m_stepping)
+        retval = this->profile_sample();
+      else
+        retval = this->poll_stop();
+      lock.lock();
+
+      // recorded runs go on right away
+      if (retval && m_running && !m_record && !m_stop && !m_break && m_packets.empty()) {
+        if (m_profiler && !m_stepping)
+          m_cond.wait_for(lock, std::chrono::microseconds(m_profiler->get_period_us()));
+        else
+          m_cond.wait_for(lock, std::chrono::milliseconds(RSP_POLL_MS));
+      }
+    } else {
+      m_cond.wait(lock);
+    }
+
+    if (!retval)
+      break;
+  }
+
+  lock.unlock();
+
+  // let the reactor see the end of the session, it then cleans it up
+  m_transport->shutdown();
 }
 
 bool
-Rsp::wait_client() {
-  if((m_socket_client = accept(m_socket_in, NULL, NULL)) == -1) {
-    if(errno == EAGAIN)
-      return false;
+Rsp::poll_stop() {
+  DbgIF* stopped = NULL;
+
+  //Check if one core has stopped
+  if (m_wait_dbgif) {
+    if (m_wait_dbgif->is_stopped())
+      stopped = m_wait_dbgif;
+  } else {
+    for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+      if ((*it)->is_stopped()) {
+        stopped = *it;
+        m_thread_sel = (*it)->get_thread_id();
+        break;
+      }
+    }
+  }
+
+  if (stopped == NULL)
+    return true;
+
+  // The break flag is raised before the cores are halted, so if it is set the
+  // cores might have stopped because of it. Report it as an interrupt, once.
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_break)
+      return true;
+  }
+
+  return this->coreStopped(stopped);
+}
+
+bool
+Rsp::profile_sample() {
+  std::list<DbgIF*> wait_cores;
+  std::list<DbgIF*>* cores = &m_dbgifs;
+  DbgIF* stopped;
+
+  if (m_wait_dbgif) {
+    wait_cores.push_back(m_wait_dbgif);
+    cores = &wait_cores;
+  }
 
-    fprintf(stderr, "Unable to accept connection: %s\n", strerror(errno));
+  // sampling also tells whether a core has stopped, no need to poll
+  if (!m_profiler->sample(cores, &stopped))
     return false;
+
+  // The break flag is held while resuming, as the cores must stay halted
+  // once a break came in. It is then reported as an interrupt.
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_break)
+    return true;
+
+  if (stopped == NULL)
+    return m_profiler->resume(cores);
+
+  lock.unlock();
+
+  return this->coreStopped(stopped);
+}
+
+bool
+Rsp::coreStopped(DbgIF* stopped) {
+  if (m_coverage) {
+    bool handled;
+
+    if (!this->coverage(&handled))
+      return false;
+
+    if (handled)
+      return true;
   }
 
-  log->debug("RSP: Client connected!\n");
-  return true;
+  if (m_semihost) {
+    bool handled;
+
+    if (!this->semihost(&handled))
+      return false;
+
+    if (handled)
+      return true;
+  }
+
+  m_running = false;
+  m_thread_sel = stopped->get_thread_id();
+  this->runStopped();
+  return this->send_stop_reason();
 }
 
 bool
-Rsp::loop() {
-  char pkt[PACKET_MAX_LEN];
-  size_t len;
+Rsp::semihost(bool* handled) {
+  std::list<DbgIF*> wait_cores;
+  std::list<DbgIF*>* cores = &m_dbgifs;
+  std::vector<struct mem_txn> txns;
+  size_t nb_cores;
+
+  *handled = false;
+
+  if (m_wait_dbgif) {
+    wait_cores.push_back(m_wait_dbgif);
+    cores = &wait_cores;
+  }
+
+  nb_cores = cores->size();
+  std::vector<uint32_t> cause(nb_cores);
+  std::vector<uint32_t> ppc(nb_cores);
+  std::vector<uint32_t> regs(nb_cores * 2);
+  std::vector<uint32_t> args(nb_cores * 3, 0);
+  std::vector<bool> ecall(nb_cores, false);
+
+  // why each core stopped, and a0 and a1 in case it is a call
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    txns.push_back((*it)->txn(0, DBG_CAUSE_REG, &cause[i]));
+    txns.push_back((*it)->txn(0, DBG_PPC_REG, &ppc[i]));
+
+    struct mem_txn txn = (*it)->txn(0, 0x0400 + 10 * 4, &regs[i * 2]);
+    txn.size = 2 * 4;
+    txns.push_back(txn);
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  // Only calls are handled here, a core which stopped for another reason is
+  // reported to gdb, the others were halted along with it
+  bool calls = false;
+  for (i = 0; i < nb_cores; i++) {
+    bool irq = cause[i] & (1 << 31);
+    uint32_t reason = cause[i] & 0x1F;
+
+    if (!irq && (reason == CAUSE_ECALL_MMODE || reason == CAUSE_ECALL_UMODE)) {
+      ecall[i] = true;
+      calls = true;
+    } else if (irq || reason != CAUSE_HALT) {
+      return true;
+    }
+  }
+
+  if (!calls)
+    return true;
+
+  // the argument blocks of all calls in one go
+  txns.clear();
+  for (i = 0; i < nb_cores; i++) {
+    int nb_args = Semihost::nb_args(regs[i * 2]);
+
+    if (!ecall[i])
+      continue;
+
+    if (nb_args == 0) {
+      args[i * 3] = regs[i * 2 + 1];
+      continue;
+    }
+
+    struct mem_txn txn = { false, regs[i * 2 + 1], nb_args * 4, (char*)&args[i * 3] };
+    txns.push_back(txn);
+  }
+
+  if (txns.size() && !m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  // A call waiting for the console keeps all cores halted, it is tried again
+  // at the next poll, and a break from gdb can still come in meanwhile
+  for (i = 0; i < nb_cores; i++) {
+    if (ecall[i] && !m_semihost->ready(regs[i * 2], &args[i * 3])) {
+      *handled = true;
+      return true;
+    }
+  }
+
+  txns.clear();
+  i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    bool exited;
+    int exit_code;
+
+    if (!ecall[i])
+      continue;
 
-  while (this->get_packet(pkt, &len)) {
-    log->debug("Received $%.*s\n", len, pkt);
-    if (!this->decode(pkt, len))
+    if (!m_semihost->call(regs[i * 2], &args[i * 3], &regs[i * 2], &exited, &exit_code))
       return false;
+
+    if (exited) {
+      char reply[4];
+
+      *handled = true;
+      m_running = false;
+      this->runStopped();
+
+      snprintf(reply, sizeof(reply), "W%02x", exit_code & 0xFF);
+      return this->send_str(reply);
+    }
+
+    // the result goes to a0 and the core goes on after the ecall
+    ppc[i] += 4;
+    txns.push_back((*it)->txn(1, 0x0400 + 10 * 4, &regs[i * 2]));
+    txns.push_back((*it)->txn(1, DBG_NPC_REG, &ppc[i]));
   }
 
-  return true;
+  *handled = true;
+  return this->resumeRunning(cores, &txns);
+}
+
+bool
+Rsp::resumeRunning(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns) {
+  uint32_t ctrl_cont;
+  uint32_t mask;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // a break came in, the cores stay halted and the break is reported next
+  if (!m_break)
+    DbgIF::resume_txns(cores, txns, &ctrl_cont, &mask);
+
+  if (txns->empty())
+    return true;
+
+  return m_mem->access_batch(&(*txns)[0], txns->size());
+}
+
+bool
+Rsp::coverage(bool* handled) {
+  std::list<DbgIF*> wait_cores;
+  std::list<DbgIF*>* cores = &m_dbgifs;
+  std::vector<struct mem_txn> txns;
+  bool report = false;
+
+  *handled = false;
+
+  if (m_wait_dbgif) {
+    wait_cores.push_back(m_wait_dbgif);
+    cores = &wait_cores;
+  }
+
+  std::vector<uint32_t> cause(cores->size());
+  std::vector<uint32_t> ppc(cores->size());
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    txns.push_back((*it)->txn(0, DBG_CAUSE_REG, &cause[i]));
+    txns.push_back((*it)->txn(0, DBG_PPC_REG, &ppc[i]));
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  // The blocks reached by the cores are recorded and their breakpoints
+  // removed, whatever else happened. The cores go on from the start of the
+  // block, unless gdb has its own breakpoint there.
+  bool blocks = false;
+  txns.clear();
+  i = 0;
+  for (std::list<DbgIF*>::iterator it = cores->begin(); it != cores->end(); it++, i++) {
+    bool irq = cause[i] & (1 << 31);
+    uint32_t reason = cause[i] & 0x1F;
+
+    if (!irq && reason == CAUSE_BREAKPOINT && m_coverage->is_block(ppc[i])) {
+      m_coverage->hit(ppc[i]);
+      blocks = true;
+
+      if (m_bp->at_addr(ppc[i]))
+        report = true;
+      else
+        txns.push_back((*it)->txn(1, DBG_NPC_REG, &ppc[i]));
+    } else if (irq || reason != CAUSE_HALT) {
+      report = true;
+    }
+  }
+
+  if (!blocks)
+    return true;
+
+  // the original instructions are written back with a single cache flush
+  if (!m_bp->commit())
+    return false;
+
+  if (report)
+    return txns.empty() || m_mem->access_batch(&txns[0], txns.size());
+
+  *handled = true;
+  return this->resumeRunning(cores, &txns);
+}
+
+bool
+Rsp::resumeRecorded(bool step) {
+  uint32_t pc;
+  bool stopped = false;
+
+  DbgIF* dbgif = this->get_dbgif(m_thread_sel);
+  if (dbgif == NULL || !this->pc_read(&pc) || !m_record->start(dbgif, pc))
+    return this->send_str("E01");
+
+  if (!step) {
+    this->runStarting(false);
+    m_running = true;
+    m_wait_dbgif = dbgif;
+    return this->record_steps();
+  }
+
+  bool retval = m_record->step(&stopped);
+  retval = m_record->finish() && retval;
+  if (!retval)
+    fprintf(stderr, "RSP: Recorded step failed, see above\n");
+
+  return this->send_stop_reason();
+}
+
+bool
+Rsp::record_steps() {
+  bool stopped = false;
+  bool retval = true;
+
+  // A recorded run stops before executing a breakpoint, instead of trapping
+  // on it, or when the core stops on its own, e.g. on an exception
+  for (int i = 0; i < RSP_RECORD_STEPS && retval && !stopped; i++) {
+    retval = m_record->step(&stopped);
+    stopped = stopped || m_bp->at_addr(m_record->get_pc());
+  }
+
+  if (retval && !stopped)
+    return true;
+
+  if (!retval)
+    fprintf(stderr, "RSP: Recorded run failed, see above\n");
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_break)
+      return true;
+  }
+
+  m_running = false;
+  m_record->finish();
+  this->runStopped();
+  return this->send_stop_reason();
+}
+
+bool
+Rsp::reverse(bool cont) {
+  bool begin;
+
+  if (m_record == NULL)
+    return this->send_str("E01");
+
+  DbgIF* dbgif = this->get_dbgif(m_thread_sel);
+  if (dbgif == NULL || !m_record->undo(dbgif, cont, &begin))
+    return this->send_str("E01");
+
+  // Cf. the replaylog stop reason of
+  // https://sourceware.org/gdb/onlinedocs/gdb/Stop-Reply-Packets.html
+  if (begin)
+    return this->send_str("T05replaylog:begin;");
+
+  return this->send_signal(TARGET_SIGNAL_TRAP);
 }
 
 bool
@@ -120,12 +607,44 @@ Rsp::ctrlc() {
   // Cf. https://sourceware.org/gdb/onlinedocs/gdb/Interrupts.html
   log->debug ("Received break\n");
 
-  DbgIF* dbgif = this->get_dbgif(m_thread_sel);
-  if (!dbgif->halt() || !dbgif->is_stopped()) {
-    printf("ERROR: could not halt.\n");
-    return false;
+  if (!m_running) {
+    DbgIF* dbgif = this->get_dbgif(m_thread_sel);
+    if (!dbgif->halt() || !dbgif->is_stopped()) {
+      printf("ERROR: could not halt.\n");
+      return false;
+    }
+
+    return this->send_signal(TARGET_SIGNAL_INT);
+  }
+
+  m_running = false;
+
+  if (m_wait_dbgif) {
+    if (!m_wait_dbgif->halt()) {
+      printf("ERROR: failed sending halt\n");
+    }
+
+    if (!m_wait_dbgif->is_stopped()) {
+      printf("ERROR: failed to stop core\n");
+      return false;
+    }
+  } else {
+    for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+      if (!(*it)->halt()) {
+        printf("ERROR: failed sending halt\n");
+      }
+
+      if (!(*it)->is_stopped()) {
+        printf("ERROR: failed to stop core\n");
+        return false;
+      }
+    }
   }
 
+  if (m_record)
+    m_record->finish();
+
+  this->runStopped();
   return this->send_signal(TARGET_SIGNAL_INT);
 }
 
@@ -156,6 +675,11 @@ Rsp::decode(char* data, size_t len) {
   case 'S':
     return this->step(&data[0], len);
 
+  case 'b':
+    if (data[1] == 's' || data[1] == 'c')
+      return this->reverse(data[1] == 'c');
+    return this->send_str("");
+
   case 'H':
     return this->multithread(&data[1], len-1);
 
@@ -227,7 +751,10 @@ Rsp::cont(char* data, size_t len) {
       dbgif->write(DBG_NPC_REG, addr);
   }
 
-  m_thread_sel = 0;
+  if (m_record)
+    return this->resumeRecorded(false);
+
+  m_thread_sel = m_dbgifs.front()->get_thread_id();
 
   return this->resume(false);
 }
@@ -257,7 +784,10 @@ Rsp::step(char* data, size_t len) {
       dbgif->write(DBG_NPC_REG, addr);
   }
 
-  m_thread_sel = 0;
+  if (m_record)
+    return this->resumeRecorded(true);
+
+  m_thread_sel = m_dbgifs.front()->get_thread_id();
 
   return this->resume(true);
 }
@@ -281,107 +811,831 @@ Rsp::multithread(char* data, size_t len) {
         return this->send_str("OK");
       }
 
-      return this->send_str("E01");
+      return this->send_str("E01");
+  }
+
+  return false;
+}
+
+#define PULP_CTRL_AXI_ADDR   0x51000000
+#include "mem_zynq_apb_spi.h"
+
+int pulp_ctrl(int fetch_en, int reset) {
+  static volatile uint32_t* ctrl_base = NULL;
+    if (MemIF::mmap_gen(PULP_CTRL_AXI_ADDR, 0x1000, &ctrl_base) != 0) {
+      fprintf(stderr, "Could not map CTRL interface\n");
+      return 1;
+    }
+
+  volatile uint32_t* gpio = ctrl_base + 0x0; // FIXME: name
+  volatile uint32_t* dir  = ctrl_base + 0x1;
+
+  // now we can actually write to the peripheral
+  uint32_t val = 0x0;
+  if (reset == 0)
+    val |= (1 << 31); // reset is active low
+
+  if (fetch_en)
+    val |= (1 << 0);
+
+  *dir  = 0x0; // configure as output
+  *gpio = val;
+
+  return 0;
+}
+
+#define SPIDEV "/dev/spidev32766.0"
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+int set_boot_addr(uint32_t boot_addr) {
+  int fd;
+  uint8_t wr_buf[9];
+  int retval = 0;
+
+  const uint32_t reg_addr = 0x1A107008;
+
+  wr_buf[0] = 0x02; // write command
+  wr_buf[1] = (reg_addr >> 24) & 0xFF;
+  wr_buf[2] = (reg_addr >> 16) & 0xFF;
+  wr_buf[3] = (reg_addr >>  8) & 0xFF;
+  wr_buf[4] = (reg_addr >>  0) & 0xFF;
+  // address
+  wr_buf[5] = (boot_addr >> 24) & 0xFF;
+  wr_buf[6] = (boot_addr >> 16) & 0xFF;
+  wr_buf[7] = (boot_addr >>  8) & 0xFF;
+  wr_buf[8] = (boot_addr >>  0) & 0xFF;
+
+  fd = open(SPIDEV, O_RDWR);
+  if (fd <= 0) {
+    perror(SPIDEV " not found");
+
+    retval = -1;
+    goto fail;
+  }
+
+  if (write(fd, wr_buf, 9) != 9) {
+    perror("Could not write to " SPIDEV);
+
+    retval = -1;
+    goto fail;
+  }
+
+fail:
+  close(fd);
+
+  return retval;
+}
+
+bool
+Rsp::monitor_help(char *str, size_t len) {
+  const char *text;
+  if (strncmp ("reset", str, strlen("reset")) == 0)
+  {
+    static const char text_reset[] = 
+      "Help for reset:\n"
+      "	run  -- Reset and restart the target core\n"
+      "	halt -- Reset the target core and hold its execution\n"
+    ;
+    text = text_reset;
+  }
+  else if (strncmp ("cores", str, strlen("cores")) == 0)
+  {
+    static const char text_cores[] =
+      "Help for cores:\n"
+      "	cores           -- List the cores debugged by this client\n"
+      "	cores <id> ...  -- Debug the given cores (thread ids, in hex) with this client,\n"
+      "	                   they must not be owned by another client\n"
+    ;
+    text = text_cores;
+  }
+  else if (strncmp ("memstats", str, strlen("memstats")) == 0)
+  {
+    static const char text_memstats[] =
+      "Help for memstats:\n"
+      "	memstats        -- Show the target access latencies per scheduling class\n"
+      "	memstats reset  -- Clear the counters\n"
+    ;
+    text = text_memstats;
+  }
+  else if (strncmp ("load", str, strlen("load")) == 0)
+  {
+    static const char text_load[] =
+      "Help for load:\n"
+      "	load <path>     -- Load an ELF file from the bridge host and set the PC of\n"
+      "	                   the cores to its entry point. Only the pages which\n"
+      "	                   changed since the previous load are written.\n"
+      "	load -f <path>  -- Write the whole file\n"
+      "	load -v <path>  -- Also check the unchanged pages on the target\n"
+    ;
+    text = text_load;
+  }
+  else if (strncmp ("dump", str, strlen("dump")) == 0 || strncmp ("restore", str, strlen("restore")) == 0 ||
+           strncmp ("fill", str, strlen("fill")) == 0 || strncmp ("compare", str, strlen("compare")) == 0)
+  {
+    static const char text_memops[] =
+      "Help for memory commands:\n"
+      "	dump <addr> <len> <file>     -- Write target memory to a file on the bridge host\n"
+      "	restore <file> <addr>        -- Write a file from the bridge host to target memory\n"
+      "	fill <addr> <len> <pattern>  -- Fill target memory with a 32 bits pattern\n"
+      "	compare <addr> <file>        -- Compare target memory with a file\n"
+    ;
+    text = text_memops;
+  }
+  else if (strncmp ("checkpoint", str, strlen("checkpoint")) == 0)
+  {
+    static const char text_checkpoint[] =
+      "Help for checkpoint:\n"
+      "	checkpoint save <file>           -- Save the registers of the cores and the\n"
+      "	                                    checkpoint regions to a file\n"
+      "	checkpoint restore <file>        -- Write a saved state back to the target\n"
+      "	checkpoint regions               -- List the memory regions which are saved\n"
+      "	checkpoint region <addr> <len>   -- Add a memory region, len a multiple of 4\n"
+      "	checkpoint region clear          -- Only save the registers\n"
+    ;
+    text = text_checkpoint;
+  }
+  else if (strncmp ("profile", str, strlen("profile")) == 0)
+  {
+    static const char text_profile[] =
+      "Help for profile:\n"
+      "	profile start <hz>          -- Sample the PC of the running cores <hz> times per second\n"
+      "	profile start <hz> stacks   -- Sample call stacks, the code must keep frame pointers\n"
+      "	profile stop <file>         -- Stop sampling and write a pprof CPU profile to <file>,\n"
+      "	                               and one per core to <file>.<thread id>\n"
+      "	profile stop <file> <elf>   -- Write call stacks as folded stacks, with the function\n"
+      "	                               names of <elf>\n"
+      "	profile                     -- Show the number of samples and the sampling overhead\n"
+    ;
+    text = text_profile;
+  }
+  else if (strncmp ("perf", str, strlen("perf")) == 0)
+  {
+    static const char text_perf[] =
+      "Help for perf:\n"
+      "	perf start [<events>]  -- Count events on the cores, by default cycles, instr,\n"
+      "	                          ld_stall, jr_stall, imiss, ld, st and tcdm_cont. Events\n"
+      "	                          are separated by commas, all selects all of them.\n"
+      "	perf read              -- Show the counters of the last run, per core and in total\n"
+      "	perf stop              -- Stop counting\n"
+      "	perf events            -- List the events\n"
+    ;
+    text = text_perf;
+  }
+  else if (strncmp ("last-run", str, strlen("last-run")) == 0)
+  {
+    static const char text_last_run[] =
+      "Help for last-run:\n"
+      "	last-run  -- Show the cycles counted by each core during the last run, from\n"
+      "	             the resume to the stop, and the time it took on the host\n"
+    ;
+    text = text_last_run;
+  }
+  else if (strncmp ("semihosting", str, strlen("semihosting")) == 0)
+  {
+    static const char text_semihosting[] =
+      "Help for semihosting:\n"
+      "	semihosting on   -- Serve the semihosting calls (ecall with the operation in\n"
+      "	                    a0 and the argument block in a1) of the cores in the bridge\n"
+      "	semihosting off  -- Report ecalls to gdb, and close the files of the target\n"
+    ;
+    text = text_semihosting;
+  }
+  else if (strncmp ("watch", str, strlen("watch")) == 0)
+  {
+    static const char text_watch[] =
+      "Help for watch:\n"
+      "	watch add <addr> <size>               -- Watch size (1, 2, 4 or 8) bytes at addr\n"
+      "	watch clear                           -- Forget all watched variables\n"
+      "	watch stream <file> <hz> [binary]     -- Sample the variables at hz without halting\n"
+      "	                                         the cores, into a CSV or binary file\n"
+      "	watch stop                            -- Stop sampling\n"
+      "	watch                                 -- Show the variables and the samples taken\n"
+    ;
+    text = text_watch;
+  }
+  else if (strncmp ("coverage", str, strlen("coverage")) == 0)
+  {
+    static const char text_coverage[] =
+      "Help for coverage:\n"
+      "	coverage start <file>                  -- Put a one-shot breakpoint on each block\n"
+      "	                                          listed in file, one address per line\n"
+      "	coverage stop <file> [drcov [<elf>]]   -- Write the covered blocks, as addresses or\n"
+      "	                                          as drcov, and remove the breakpoints\n"
+      "	coverage                               -- Show how many blocks are covered\n"
+    ;
+    text = text_coverage;
+  }
+  else if (strncmp ("lockstep", str, strlen("lockstep")) == 0)
+  {
+    static const char text_lockstep[] =
+      "Help for lockstep:\n"
+      "	lockstep <n> <file>  -- Single-step all cluster cores of this client together,\n"
+      "	                        n times, and write their PCs at each step to file,\n"
+      "	                        which debug_bridge --decode-trace prints. Use\n"
+      "	                        flushregs afterwards for gdb to see the new state.\n"
+    ;
+    text = text_lockstep;
+  }
+  else if (strncmp ("record", str, strlen("record")) == 0)
+  {
+    static const char text_record[] =
+      "Help for record:\n"
+      "	record start [<MB>]  -- Log each instruction of the selected core, which is then\n"
+      "	                        stepped by the bridge, for reverse-stepi and\n"
+      "	                        reverse-continue. The oldest ones are dropped once the\n"
+      "	                        log is full, 16 MB by default.\n"
+      "	record stop          -- Stop recording and drop the log\n"
+      "	record               -- Show the size of the log and the recording rate\n"
+    ;
+    text = text_record;
+  }
+  else if (strncmp ("trace", str, strlen("trace")) == 0)
+  {
+    static const char text_trace[] =
+      "Help for trace:\n"
+      "	trace <n> <file>  -- Single-step the selected core n times and write its PCs to\n"
+      "	                     file, which debug_bridge --decode-trace prints. Use\n"
+      "	                     flushregs afterwards for gdb to see the new state.\n"
+    ;
+    text = text_trace;
+  }
+  else if (strncmp ("rtt", str, strlen("rtt")) == 0)
+  {
+    static const char text_rtt[] =
+      "Help for rtt:\n"
+      "	rtt  -- Show where the RTT control block is and the bytes moved on each\n"
+      "	        channel. RTT is enabled with the --rtt option of the bridge.\n"
+    ;
+    text = text_rtt;
+  }
+  else 
+  {
+    static const char text_general[] = 
+      "General commands:\n"
+      "	help  -- Display help for monitor commands\n"
+      "	reset -- Reset the target core\n"
+      "	cores -- Show or select the cores debugged by this client\n"
+      "	memstats -- Show target access latencies\n"
+      "	load  -- Load an ELF file from the bridge host\n"
+      "	dump, restore, fill, compare -- Bulk memory operations\n"
+      "	checkpoint -- Save and restore the target state\n"
+      "	profile -- Sample the PC of the running cores\n"
+      "	perf  -- Count hardware events on the cores\n"
+      "	last-run -- Show the cost of the last run\n"
+      "	semihosting -- Serve semihosting calls\n"
+      "	rtt   -- Show the RTT channels\n"
+      "	watch -- Sample variables while the cores run\n"
+      "	coverage -- Collect basic block coverage\n"
+      "	trace -- Record the PCs of the selected core\n"
+      "	record -- Log the execution for reverse debugging\n"
+      "	lockstep -- Step the cluster cores together\n"
+    ;
+    text = text_general;
+  }
+  char out[2048];
+  if (!encode_hex(text, out, sizeof(out)))
+    return this->send_str("E00");
+
+  return this->send_str(out);
+}
+
+bool
+Rsp::monitor_reply(const char *str, ...) {
+  char text[PACKET_MAX_LEN / 2];
+  char out[PACKET_MAX_LEN];
+  va_list va;
+
+  va_start(va, str);
+  vsnprintf(text, sizeof(text), str, va);
+  va_end(va);
+
+  if (!encode_hex(text, out, sizeof(out)))
+    return this->send_str("E00");
+
+  return this->send_str(out);
+}
+
+bool
+Rsp::monitor_cores(char *str, size_t len) {
+  std::list<unsigned int> thread_ids;
+  std::list<DbgIF*> cores;
+  char text[512];
+  int text_len = 0;
+
+  char *tok = strtok(str, " \t,");
+  while (tok != NULL) {
+    thread_ids.push_back(strtoul(tok, NULL, 16));
+    tok = strtok(NULL, " \t,");
+  }
+
+  if (thread_ids.size() != 0) {
+    if (m_running || !m_server->bind_cores(this, thread_ids, &cores))
+      return this->monitor_reply("Could not select cores, see bridge output\n");
+
+    this->set_cores(cores);
+  }
+
+  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+    text_len += snprintf(&text[text_len], sizeof(text) - text_len, "%X ", (*it)->get_thread_id());
+    if (text_len >= (int)sizeof(text))
+      break;
+  }
+
+  return this->monitor_reply("Debugging cores: %s\n", text);
+}
+
+bool
+Rsp::monitor_memstats(char *str, size_t len) {
+  char text[1024];
+
+  str += strspn(str, " \t");
+  if (strncmp(str, "reset", strlen("reset")) == 0) {
+    m_mem->reset_stats();
+    return this->monitor_reply("Counters cleared\n");
+  }
+
+  m_mem->dump_stats(text, sizeof(text));
+  return this->monitor_reply("%s", text);
+}
+
+bool
+Rsp::monitor_load(char *str, size_t len) {
+  Loader* loader = m_server->get_loader();
+  bool full = false;
+  bool verify = false;
+  char report[256];
+
+  str += strspn(str, " \t");
+  while (str[0] == '-') {
+    if (str[1] == 'f')
+      full = true;
+    else if (str[1] == 'v')
+      verify = true;
+    else
+      break;
+
+    str += 2;
+    str += strspn(str, " \t");
+  }
+
+  if (*str == '\0' || *str == '-')
+    return this->monitor_reply("Usage: monitor load [-f] [-v] <path>\n");
+
+  if (!loader->load(str, full, verify))
+    return this->monitor_reply("Could not load %s, see bridge output\n", str);
+
+  loader->set_entry(&m_dbgifs);
+  loader->get_report(report, sizeof(report));
+
+  return this->monitor_reply("%s", report);
+}
+
+bool
+Rsp::monitor_memops(char *str, size_t len) {
+  MemOps ops(m_mem, m_bp, m_server->get_loader());
+  char report[256];
+  char *args[4];
+  int nb_args = 0;
+  bool retval = false;
+
+  char *tok = strtok(str, " \t");
+  while (tok != NULL && nb_args < 4) {
+    args[nb_args++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+
+  if (strcmp(args[0], "dump") == 0 && nb_args == 4) {
+    retval = ops.dump(strtoul(args[1], NULL, 0), strtoul(args[2], NULL, 0), args[3]);
+  } else if (strcmp(args[0], "restore") == 0 && nb_args == 3) {
+    retval = ops.restore(args[1], strtoul(args[2], NULL, 0));
+  } else if (strcmp(args[0], "fill") == 0 && nb_args == 4) {
+    retval = ops.fill(strtoul(args[1], NULL, 0), strtoul(args[2], NULL, 0), strtoul(args[3], NULL, 0));
+  } else if (strcmp(args[0], "compare") == 0 && nb_args == 3) {
+    uint32_t differences, first_diff;
+
+    if (!ops.compare(strtoul(args[1], NULL, 0), args[2], &differences, &first_diff))
+      return this->monitor_reply("Could not compare, see bridge output\n");
+
+    ops.get_report(report, sizeof(report));
+    if (differences)
+      return this->monitor_reply("%s%u bytes differ, the first one at 0x%08X\n", report, differences, first_diff);
+
+    return this->monitor_reply("%sMemory and file are identical\n", report);
+  } else {
+    return this->monitor_reply("Wrong arguments, see monitor help %s\n", args[0]);
+  }
+
+  if (!retval)
+    return this->monitor_reply("Could not %s, see bridge output\n", args[0]);
+
+  ops.get_report(report, sizeof(report));
+  return this->monitor_reply("%s", report);
+}
+
+bool
+Rsp::monitor_checkpoint(char *str, size_t len) {
+  Checkpoint* checkpoint = m_server->get_checkpoint();
+  char report[256];
+  char *args[3];
+  int nb_args = 0;
+
+  char *tok = strtok(str, " \t");
+  while (tok != NULL && nb_args < 3) {
+    args[nb_args++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+
+  if (nb_args == 0)
+    return this->monitor_reply("Wrong arguments, see monitor help checkpoint\n");
+
+  if (strcmp(args[0], "regions") == 0 && nb_args == 1) {
+    std::list<struct checkpoint_region> regions = checkpoint->get_regions();
+    char text[512];
+    int text_len = 0;
+
+    text_len += snprintf(text, sizeof(text), "Checkpoint regions:\n");
+    for (std::list<struct checkpoint_region>::iterator it = regions.begin(); it != regions.end(); it++) {
+      text_len += snprintf(&text[text_len], sizeof(text) - text_len, "  0x%08X - 0x%08X\n", it->addr, it->addr + it->len);
+      if (text_len >= (int)sizeof(text))
+        break;
+    }
+
+    return this->monitor_reply("%s", text);
+  }
+
+  if (strcmp(args[0], "region") == 0 && nb_args == 2 && strcmp(args[1], "clear") == 0) {
+    checkpoint->clear_regions();
+    return this->monitor_reply("Checkpoint regions cleared\n");
+  }
+
+  if (strcmp(args[0], "region") == 0 && nb_args == 3) {
+    if (!checkpoint->add_region(strtoul(args[1], NULL, 0), strtoul(args[2], NULL, 0)))
+      return this->monitor_reply("The length of a region must be a multiple of 4\n");
+
+    return this->monitor_reply("Checkpoint region added\n");
+  }
+
+  if (nb_args != 2 || (strcmp(args[0], "save") != 0 && strcmp(args[0], "restore") != 0))
+    return this->monitor_reply("Wrong arguments, see monitor help checkpoint\n");
+
+  // the cores are only in a consistent state while halted
+  if (m_running)
+    return this->monitor_reply("Cores are running, halt them first\n");
+
+  bool retval;
+  if (strcmp(args[0], "save") == 0)
+    retval = checkpoint->save(args[1], &m_dbgifs);
+  else
+    retval = checkpoint->restore(args[1], &m_dbgifs);
+
+  if (!retval)
+    return this->monitor_reply("Could not %s checkpoint, see bridge output\n", args[0]);
+
+  checkpoint->get_report(report, sizeof(report));
+  return this->monitor_reply("%s", report);
+}
+
+bool
+Rsp::monitor_profile(char *str, size_t len) {
+  char report[1024];
+  char *args[3];
+  int nb_args = 0;
+
+  char *tok = strtok(str, " \t");
+  while (tok != NULL && nb_args < 3) {
+    args[nb_args++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+
+  if (nb_args == 0) {
+    if (m_profiler == NULL)
+      return this->monitor_reply("Not profiling\n");
+
+    m_profiler->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (strcmp(args[0], "start") == 0 && (nb_args == 2 || (nb_args == 3 && strcmp(args[2], "stacks") == 0))) {
+    unsigned int hz = strtoul(args[1], NULL, 0);
+
+    if (m_profiler)
+      return this->monitor_reply("Already profiling\n");
+
+    if (hz == 0 || hz > PROFILER_MAX_HZ)
+      return this->monitor_reply("The frequency must be between 1 and %d Hz\n", PROFILER_MAX_HZ);
+
+    m_profiler = new Profiler(m_mem, m_dbgifs, hz, nb_args == 3);
+    return this->monitor_reply("Profiling %s at %u Hz while the cores run\n", nb_args == 3 ? "call stacks" : "PCs", hz);
+  }
+
+  if (strcmp(args[0], "stop") == 0 && nb_args >= 2) {
+    if (m_profiler == NULL)
+      return this->monitor_reply("Not profiling\n");
+
+    bool retval = m_profiler->write(args[1], nb_args == 3 ? args[2] : NULL);
+    m_profiler->get_report(report, sizeof(report));
+
+    delete m_profiler;
+    m_profiler = NULL;
+
+    if (!retval)
+      return this->monitor_reply("%sCould not write %s, see bridge output\n", report, args[1]);
+
+    return this->monitor_reply("%s", report);
+  }
+
+  return this->monitor_reply("Wrong arguments, see monitor help profile\n");
+}
+
+bool
+Rsp::monitor_perf(char *str, size_t len) {
+  char report[PACKET_MAX_LEN / 2];
+
+  str += strspn(str, " \t");
+
+  if (strncmp(str, "start", strlen("start")) == 0) {
+    uint32_t events;
+
+    if (!PerfCounters::parse_events(&str[strlen("start")], &events))
+      return this->monitor_reply("Unknown event, see monitor perf events\n");
+
+    if (m_perf == NULL)
+      m_perf = new PerfCounters(m_mem, m_dbgifs);
+
+    if (!m_perf->start(events))
+      return this->monitor_reply("Could not program the counters, see bridge output\n");
+
+    return this->monitor_reply("Counting, the counters are read at the end of each run\n");
+  }
+
+  if (strncmp(str, "events", strlen("events")) == 0) {
+    PerfCounters::list_events(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (m_perf == NULL)
+    return this->monitor_reply("Not counting, see monitor help perf\n");
+
+  if (strncmp(str, "read", strlen("read")) == 0) {
+    m_perf->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (strncmp(str, "stop", strlen("stop")) == 0) {
+    m_perf->stop();
+    delete m_perf;
+    m_perf = NULL;
+    return this->monitor_reply("Counting stopped\n");
+  }
+
+  return this->monitor_reply("Wrong arguments, see monitor help perf\n");
+}
+
+bool
+Rsp::monitor_watch(char *str, size_t len) {
+  char report[PACKET_MAX_LEN / 2];
+  char *args[4];
+  int nb_args = 0;
+
+  char *tok = strtok(str, " \t");
+  while (tok != NULL && nb_args < 4) {
+    args[nb_args++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+
+  if (nb_args == 0) {
+    m_watch->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (strcmp(args[0], "stop") == 0 && nb_args == 1) {
+    if (!m_watch->streaming())
+      return this->monitor_reply("Not streaming\n");
+
+    m_watch->stop();
+    m_watch->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (m_watch->streaming())
+    return this->monitor_reply("Already streaming, stop it first\n");
+
+  if (strcmp(args[0], "add") == 0 && nb_args == 3) {
+    if (!m_watch->add(strtoul(args[1], NULL, 0), strtoul(args[2], NULL, 0)))
+      return this->monitor_reply("Could not watch %s, the size must be 1, 2, 4 or 8 and at most %d variables can be watched\n",
+        args[1], WATCH_MAX_VARS);
+
+    return this->monitor_reply("Variable added\n");
+  }
+
+  if (strcmp(args[0], "clear") == 0 && nb_args == 1) {
+    m_watch->clear();
+    return this->monitor_reply("Variables cleared\n");
+  }
+
+  if (strcmp(args[0], "stream") == 0 && (nb_args == 3 || (nb_args == 4 && strcmp(args[3], "binary") == 0))) {
+    unsigned int hz = strtoul(args[2], NULL, 0);
+
+    if (m_watch->empty())
+      return this->monitor_reply("No variables watched, see monitor watch add\n");
+
+    if (hz == 0 || hz > WATCH_MAX_HZ)
+      return this->monitor_reply("The frequency must be between 1 and %d Hz\n", WATCH_MAX_HZ);
+
+    if (!m_watch->start(args[1], hz, nb_args == 4))
+      return this->monitor_reply("Could not write %s, see bridge output\n", args[1]);
+
+    return this->monitor_reply("Streaming to %s at %u Hz\n", args[1], hz);
+  }
+
+  return this->monitor_reply("Wrong arguments, see monitor help watch\n");
+}
+
+bool
+Rsp::monitor_coverage(char *str, size_t len) {
+  char report[256];
+  char *args[4] = { NULL, NULL, NULL, NULL };
+  int nb_args = 0;
+
+  char *tok = strtok(str, " \t");
+  while (tok != NULL && nb_args < 4) {
+    args[nb_args++] = tok;
+    tok = strtok(NULL, " \t");
+  }
+
+  if (nb_args == 0) {
+    if (m_coverage == NULL)
+      return this->monitor_reply("Not collecting coverage\n");
+
+    m_coverage->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (strcmp(args[0], "start") == 0 && nb_args == 2) {
+    if (m_coverage)
+      return this->monitor_reply("Already collecting coverage\n");
+
+    Coverage* coverage = new Coverage(m_bp);
+    if (!coverage->load(args[1])) {
+      delete coverage;
+      return this->monitor_reply("Could not read %s, see bridge output\n", args[1]);
+    }
+
+    // all breakpoints are written with one batch and one cache flush
+    coverage->start();
+    if (!m_bp->commit()) {
+      delete coverage;
+      m_bp->commit();
+      return this->monitor_reply("Could not insert the breakpoints, see bridge output\n");
+    }
+
+    m_coverage = coverage;
+    m_coverage->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+
+  if (strcmp(args[0], "stop") == 0 && (nb_args == 2 || (nb_args >= 3 && strcmp(args[2], "drcov") == 0))) {
+    if (m_coverage == NULL)
+      return this->monitor_reply("Not collecting coverage\n");
+
+    bool retval = m_coverage->write(args[1], nb_args >= 3, nb_args == 4 ? args[3] : NULL);
+    m_coverage->get_report(report, sizeof(report));
+
+    delete m_coverage;
+    m_coverage = NULL;
+    m_bp->commit();
+
+    if (!retval)
+      return this->monitor_reply("%sCould not write %s, see bridge output\n", report, args[1]);
+
+    return this->monitor_reply("%s", report);
   }
 
-  return false;
+  return this->monitor_reply("Wrong arguments, see monitor help coverage\n");
 }
 
-#define PULP_CTRL_AXI_ADDR   0x51000000
-#include "mem_zynq_apb_spi.h"
+bool
+Rsp::monitor_trace(char *str, size_t len) {
+  char report[256];
+  char path[256];
+  unsigned int nb_steps;
+  uint32_t pc;
 
-int pulp_ctrl(int fetch_en, int reset) {
-  static volatile uint32_t* ctrl_base = NULL;
-    if (MemIF::mmap_gen(PULP_CTRL_AXI_ADDR, 0x1000, &ctrl_base) != 0) {
-      fprintf(stderr, "Could not map CTRL interface\n");
-      return 1;
-    }
+  if (sscanf(str, "%u %255s", &nb_steps, path) != 2 || nb_steps == 0 || nb_steps > TRACE_MAX_STEPS)
+    return this->monitor_reply("Wrong arguments, see monitor help trace\n");
 
-  volatile uint32_t* gpio = ctrl_base + 0x0; // FIXME: name
-  volatile uint32_t* dir  = ctrl_base + 0x1;
+  if (m_running)
+    return this->monitor_reply("Cores are running, halt them first\n");
 
-  // now we can actually write to the peripheral
-  uint32_t val = 0x0;
-  if (reset == 0)
-    val |= (1 << 31); // reset is active low
+  DbgIF* dbgif = this->get_dbgif(m_thread_sel);
+  if (dbgif == NULL || !this->pc_read(&pc))
+    return this->monitor_reply("No core selected\n");
 
-  if (fetch_en)
-    val |= (1 << 0);
+  Trace trace(m_mem, m_bp);
+  bool retval = trace.record(dbgif, pc, nb_steps);
+  retval = trace.write(path) && retval;
 
-  *dir  = 0x0; // configure as output
-  *gpio = val;
+  trace.get_report(report, sizeof(report));
+  if (!retval)
+    return this->monitor_reply("%sCould not trace to %s, see bridge output\n", report, path);
 
-  return 0;
+  return this->monitor_reply("%s", report);
 }
 
-#define SPIDEV "/dev/spidev32766.0"
-#include <linux/types.h>
-#include <linux/spi/spidev.h>
-int set_boot_addr(uint32_t boot_addr) {
-  int fd;
-  uint8_t wr_buf[9];
-  int retval = 0;
+bool
+Rsp::monitor_lockstep(char *str, size_t len) {
+  std::vector<struct mem_txn> txns;
+  std::vector<DbgIF*> cores;
+  char report[256];
+  char path[256];
+  unsigned int nb_steps;
 
-  const uint32_t reg_addr = 0x1A107008;
+  if (sscanf(str, "%u %255s", &nb_steps, path) != 2 || nb_steps == 0 || nb_steps > TRACE_MAX_STEPS)
+    return this->monitor_reply("Wrong arguments, see monitor help lockstep\n");
 
-  wr_buf[0] = 0x02; // write command
-  wr_buf[1] = (reg_addr >> 24) & 0xFF;
-  wr_buf[2] = (reg_addr >> 16) & 0xFF;
-  wr_buf[3] = (reg_addr >>  8) & 0xFF;
-  wr_buf[4] = (reg_addr >>  0) & 0xFF;
-  // address
-  wr_buf[5] = (boot_addr >> 24) & 0xFF;
-  wr_buf[6] = (boot_addr >> 16) & 0xFF;
-  wr_buf[7] = (boot_addr >>  8) & 0xFF;
-  wr_buf[8] = (boot_addr >>  0) & 0xFF;
+  if (m_running)
+    return this->monitor_reply("Cores are running, halt them first\n");
 
-  fd = open(SPIDEV, O_RDWR);
-  if (fd <= 0) {
-    perror(SPIDEV " not found");
+  // only the cluster cores are resumed by the cluster controller
+  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+    if (((*it)->get_thread_id() >> 5) < 32)
+      cores.push_back(*it);
+  }
 
-    retval = -1;
-    goto fail;
+  if (cores.empty())
+    return this->monitor_reply("No cluster core is debugged by this client\n");
+
+  // where each core is stopped, same as Rsp::pc_read
+  std::vector<uint32_t> regs(cores.size() * 4);
+  std::vector<uint32_t> pcs(cores.size());
+
+  for (size_t i = 0; i < cores.size(); i++) {
+    txns.push_back(cores[i]->txn(0, DBG_PPC_REG, &regs[i * 4]));
+    txns.push_back(cores[i]->txn(0, DBG_NPC_REG, &regs[i * 4 + 1]));
+    txns.push_back(cores[i]->txn(0, DBG_HIT_REG, &regs[i * 4 + 2]));
+    txns.push_back(cores[i]->txn(0, DBG_CAUSE_REG, &regs[i * 4 + 3]));
   }
 
-  if (write(fd, wr_buf, 9) != 9) {
-    perror("Could not write to " SPIDEV);
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return this->monitor_reply("Could not read the PCs of the cores\n");
 
-    retval = -1;
-    goto fail;
+  for (size_t i = 0; i < cores.size(); i++) {
+    uint32_t cause = regs[i * 4 + 3];
+    bool ppc = !(regs[i * 4 + 2] & 0x1) && !(cause & (1 << 31)) &&
+      ((cause & 0x1F) == CAUSE_BREAKPOINT || (cause & 0x1F) == CAUSE_ILLEGAL_INSN);
+
+    pcs[i] = ppc ? regs[i * 4] : regs[i * 4 + 1];
   }
 
-fail:
-  close(fd);
+  Trace trace(m_mem, m_bp);
+  bool retval = trace.record_cluster(cores, pcs, nb_steps);
+  retval = trace.write(path) && retval;
 
-  return retval;
+  trace.get_report(report, sizeof(report));
+  if (!retval)
+    return this->monitor_reply("%sCould not trace to %s, see bridge output\n", report, path);
+
+  return this->monitor_reply("%s", report);
 }
 
 bool
-Rsp::monitor_help(char *str, size_t len) {
-  const char *text;
-  if (strncmp ("reset", str, strlen("reset")) == 0)
-  {
-    static const char text_reset[] = 
-      "Help for reset:\n"
-      "	run  -- Reset and restart the target core\n"
-      "	halt -- Reset the target core and hold its execution\n"
-    ;
-    text = text_reset;
+Rsp::monitor_record(char *str, size_t len) {
+  char report[256];
+  char cmd[16];
+  unsigned int size = RECORD_DEFAULT_MB;
+
+  int nb_args = sscanf(str, "%15s %u", cmd, &size);
+
+  if (nb_args <= 0) {
+    if (m_record == NULL)
+      return this->monitor_reply("Not recording\n");
+
+    m_record->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
   }
-  else 
-  {
-    static const char text_general[] = 
-      "General commands:\n"
-      "	help  -- Display help for monitor commands\n"
-      "	reset -- Reset the target core\n"
-    ;
-    text = text_general;
+
+  if (m_running)
+    return this->monitor_reply("Cores are running, halt them first\n");
+
+  if (strcmp(cmd, "start") == 0 && size > 0 && size <= RECORD_MAX_MB) {
+    if (m_record)
+      return this->monitor_reply("Already recording\n");
+
+    m_record = new Record(m_mem, m_bp, (size_t)size << 20);
+    return this->monitor_reply("Recording the selected core, with a log of %u MB\n", size);
   }
-  char out[512];
-  if (!encode_hex(text, out, sizeof(out)))
-    return this->send_str("E00");
 
-  return this->send_str(out);
+  if (strcmp(cmd, "stop") == 0 && nb_args == 1) {
+    if (m_record == NULL)
+      return this->monitor_reply("Not recording\n");
+
+    m_record->get_report(report, sizeof(report));
+    delete m_record;
+    m_record = NULL;
+    return this->monitor_reply("%s", report);
+  }
+
+  return this->monitor_reply("Wrong arguments, see monitor help record\n");
 }
 
 bool
@@ -408,10 +1662,8 @@ bool
 Rsp::monitor(char *str, size_t len) {
   // Each two input characters translate to one output character + \0.
   // gdb uses a default maximum of a little under 200 characters but might
-  // grow that when receiving bigger inputs (sic)...
-  // Currently there is no need for any really big payloads thus less than
-  // 200 is used below.
-  char buf[64];
+  // grow that when receiving bigger inputs (sic), up to our packet size.
+  char buf[PACKET_MAX_LEN / 2 + 1];
   if (len/2 >= sizeof(buf)) {
     fprintf(stderr, "Insufficient buffer for complete monitor packet payload.\n");
     return this->send_str("");
@@ -425,6 +1677,9 @@ Rsp::monitor(char *str, size_t len) {
 
   size_t help_len = strlen("help");
   size_t reset_len = strlen("reset");
+  size_t cores_len = strlen("cores");
+  size_t memstats_len = strlen("memstats");
+  size_t load_len = strlen("load");
   if (strncmp(buf, "help", help_len) == 0) {
     help_len += strspn(&buf[help_len], " \t");
     return monitor_help(&buf[help_len], len-help_len);
@@ -438,6 +1693,84 @@ Rsp::monitor(char *str, size_t len) {
     }
     return this->reset(halt);
   } 
+  else if (strncmp(buf, "cores", cores_len) == 0)
+  {
+    return monitor_cores(&buf[cores_len], strlen(buf) - cores_len);
+  }
+  else if (strncmp(buf, "memstats", memstats_len) == 0)
+  {
+    return monitor_memstats(&buf[memstats_len], strlen(buf) - memstats_len);
+  }
+  else if (strncmp(buf, "load", load_len) == 0)
+  {
+    return monitor_load(&buf[load_len], strlen(buf) - load_len);
+  }
+  else if (strncmp(buf, "semihosting", strlen("semihosting")) == 0)
+  {
+    char *arg = &buf[strlen("semihosting")];
+    arg += strspn(arg, " \t");
+
+    if (strcmp(arg, "on") == 0) {
+      if (m_semihost == NULL)
+        m_semihost = new Semihost(m_mem, m_bp, m_server->get_loader(), !m_server->stdin_is_rsp());
+    } else if (strcmp(arg, "off") == 0) {
+      delete m_semihost;
+      m_semihost = NULL;
+    } else if (*arg != '\0') {
+      return this->monitor_reply("Wrong arguments, see monitor help semihosting\n");
+    }
+
+    return this->monitor_reply("Semihosting is %s\n", m_semihost ? "on" : "off");
+  }
+  else if (strncmp(buf, "record", strlen("record")) == 0)
+  {
+    return monitor_record(&buf[strlen("record")], strlen(buf) - strlen("record"));
+  }
+  else if (strncmp(buf, "lockstep", strlen("lockstep")) == 0)
+  {
+    return monitor_lockstep(&buf[strlen("lockstep")], strlen(buf) - strlen("lockstep"));
+  }
+  else if (strncmp(buf, "trace", strlen("trace")) == 0)
+  {
+    return monitor_trace(&buf[strlen("trace")], strlen(buf) - strlen("trace"));
+  }
+  else if (strncmp(buf, "coverage", strlen("coverage")) == 0)
+  {
+    return monitor_coverage(&buf[strlen("coverage")], strlen(buf) - strlen("coverage"));
+  }
+  else if (strncmp(buf, "watch", strlen("watch")) == 0)
+  {
+    return monitor_watch(&buf[strlen("watch")], strlen(buf) - strlen("watch"));
+  }
+  else if (strncmp(buf, "rtt", strlen("rtt")) == 0)
+  {
+    char report[PACKET_MAX_LEN / 2];
+    m_server->get_rtt()->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+  else if (strncmp(buf, "last-run", strlen("last-run")) == 0)
+  {
+    char report[PACKET_MAX_LEN / 2];
+    m_run_stats->get_report(report, sizeof(report));
+    return this->monitor_reply("%s", report);
+  }
+  else if (strncmp(buf, "perf", strlen("perf")) == 0)
+  {
+    return monitor_perf(&buf[strlen("perf")], strlen(buf) - strlen("perf"));
+  }
+  else if (strncmp(buf, "profile", strlen("profile")) == 0)
+  {
+    return monitor_profile(&buf[strlen("profile")], strlen(buf) - strlen("profile"));
+  }
+  else if (strncmp(buf, "checkpoint", strlen("checkpoint")) == 0)
+  {
+    return monitor_checkpoint(&buf[strlen("checkpoint")], strlen(buf) - strlen("checkpoint"));
+  }
+  else if (strncmp(buf, "dump", strlen("dump")) == 0 || strncmp(buf, "restore", strlen("restore")) == 0 ||
+           strncmp(buf, "fill", strlen("fill")) == 0 || strncmp(buf, "compare", strlen("compare")) == 0)
+  {
+    return monitor_memops(buf, strlen(buf));
+  }
 
   // Default to not supported
   return this->send_str("");
@@ -450,7 +1783,8 @@ Rsp::query(char* data, size_t len) {
 
   if (strncmp ("qSupported", data, strlen ("qSupported")) == 0)
   {
-    return this->send_str("PacketSize=256");
+    // reverse execution needs monitor record first
+    return this->send_str("PacketSize=256;ReverseStep+;ReverseContinue+");
   }
   else if (strncmp ("qTStatus", data, strlen ("qTStatus")) == 0)
   {
@@ -535,9 +1869,11 @@ Rsp::v_packet(char* data, size_t len) {
   }
   else if (strncmp ("vCont", data, strlen ("vCont")) == 0)
   {
-    bool threadsCmd[m_dbgifs.size()];
-    for (std::size_t i=0; i<m_dbgifs.size(); i++) 
-      threadsCmd[i] = false;
+    std::list<DbgIF*> threadsCmd;
+
+    // only the selected core runs while recording, as with c and s
+    if (m_record)
+      return this->resumeRecorded(data[6] == 's' || data[6] == 'S');
 
     // vCont can contains several commands, handle them in sequence
     char *str = strtok(&data[6], ";");
@@ -566,12 +1902,18 @@ Rsp::v_packet(char* data, size_t len) {
 
       if (cont) {
         if (tid == -1) {
-          for (std::size_t i=0; i<m_dbgifs.size(); i++) {
-            if (!threadsCmd[i]) resumeCoresPrepare(this->get_dbgif(i), step);
+          for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+            if (std::find(threadsCmd.begin(), threadsCmd.end(), *it) == threadsCmd.end())
+              this->resumeCoresPrepare(*it, step);
           }
         } else {
-          if (!threadsCmd[tid]) this->resumeCoresPrepare(this->get_dbgif(tid), step);
-          threadsCmd[tid] = true;
+          DbgIF* dbgif = this->get_dbgif(tid);
+          if (dbgif == NULL)
+            return this->send_str("E01");
+
+          if (std::find(threadsCmd.begin(), threadsCmd.end(), dbgif) == threadsCmd.end())
+            this->resumeCoresPrepare(dbgif, step);
+          threadsCmd.push_back(dbgif);
         }
       }
 
@@ -625,6 +1967,8 @@ Rsp::reg_read(char* data, size_t len) {
     this->get_dbgif(m_thread_sel)->gpr_read(addr, &rdata);
   else if (addr == 0x20)
     this->pc_read(&rdata);
+  else if (addr >= RSP_FIRST_CSR && addr < RSP_FIRST_CSR + 4096)
+    this->get_dbgif(m_thread_sel)->csr_read(addr - RSP_FIRST_CSR, &rdata);
   else
     return this->send_str("");
 
@@ -652,74 +1996,74 @@ Rsp::reg_write(char* data, size_t len) {
     dbgif->gpr_write(addr, wdata);
   else if (addr == 32)
     dbgif->write(DBG_NPC_REG, wdata);
+  else if (addr >= RSP_FIRST_CSR && addr < RSP_FIRST_CSR + 4096)
+    dbgif->csr_write(addr - RSP_FIRST_CSR, wdata);
   else
     return this->send_str("E01");
 
   return this->send_str("OK");
 }
 
-bool
+// Extracts the next packet from the receive buffer.
+// Returns 1 if a packet was found, 0 if more data is needed and -1 on error.
+int
 Rsp::get_packet(char* pkt, size_t* p_pkt_len) {
-  char c;
-  char check_chars[2];
-  char buffer[PACKET_MAX_LEN];
-  int  buffer_len = 0;
-  int  pkt_len;
+  size_t start = 0;
+  size_t end;
+  size_t pkt_len = 0;
   bool escaped = false;
-  int ret;
   // packets follow the format: $packet-data#checksum
   // checksum is two-digit
 
-  // poison packet
-  memset(pkt, 0, PACKET_MAX_LEN);
-  pkt_len = 0;
-
-  // first look for start bit
-  do {
-    ret = recv(m_socket_client, &c, 1, 0);
-
-    if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
-      fprintf(stderr, "RSP: Error receiving start bit: %s\n",
-              ret == 0 ? "Connection reset by peer" : strerror(errno));
-      return false;
-    }
-
-    if(ret == -1 && errno == EWOULDBLOCK) {
-      // no data available
-      continue;
-    }
-
-    // special case for 0x03 (asynchronous break)
-    if (c == 0x03) {
-      pkt[0]  = c;
-      *p_pkt_len = 1;
-      return true;
+  // first look for start bit, skipping acknowledges on the way
+  while (start < m_rx_len && m_rx_buf[start] != '$' && m_rx_buf[start] != 0x03) {
+    if (m_rx_buf[start] == '-') {
+      std::lock_guard<std::mutex> lock(m_tx_mutex);
+      if (m_tx_last != NULL) {
+        log->debug("Client requested retransmission\n");
+        if (!m_transport->write(m_tx_last, m_tx_last_len)) {
+          fprintf(stderr, "Unable to send data to client\n");
+          return -1;
+        }
+      }
     }
-  } while(c != '$');
+    start++;
+  }
 
-  buffer[0] = c;
+  if (start == m_rx_len) {
+    m_rx_len = 0;
+    return 0;
+  }
 
-  // now store data as long as we don't see #
-  do {
-    if (buffer_len >= PACKET_MAX_LEN || pkt_len >= PACKET_MAX_LEN) {
-      fprintf(stderr, "RSP: Too many characters received\n");
-      return false;
-    }
+  // drop everything before the start bit
+  m_rx_len -= start;
+  memmove(m_rx_buf, &m_rx_buf[start], m_rx_len);
 
-    ret = recv(m_socket_client, &c, 1, 0);
+  // special case for 0x03 (asynchronous break)
+  if (m_rx_buf[0] == 0x03) {
+    pkt[0] = 0x03;
+    *p_pkt_len = 1;
+    m_rx_len -= 1;
+    memmove(m_rx_buf, &m_rx_buf[1], m_rx_len);
+    return 1;
+  }
 
-    if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
-      fprintf(stderr, "RSP: Error receiving payload: %s\n",
-              ret == 0 ? "Connection reset by peer" : strerror(errno));
-      return false;
-    }
+  // now look for #, followed by the two checksum characters
+  for (end = 1; end < m_rx_len && m_rx_buf[end] != '#'; end++);
 
-    if(ret == -1 && errno == EWOULDBLOCK) {
-      // no data available
-      continue;
+  if (end + 2 >= m_rx_len) {
+    if (m_rx_len == sizeof(m_rx_buf)) {
+      fprintf(stderr, "RSP: Too many characters received\n");
+      return -1;
     }
+    return 0;
+  }
 
-    buffer[buffer_len++] = c;
+  // unescape payload and compute checksum
+  unsigned int checksum = 0;
+  for(size_t i = 1; i < end; i++) {
+    char c = m_rx_buf[i];
+    checksum += (unsigned char)c;
 
     // check for 0x7d = '}'
     if (c == 0x7d) {
@@ -733,53 +2077,37 @@ Rsp::get_packet(char* pkt, size_t* p_pkt_len) {
       pkt[pkt_len++] = c;
 
     escaped = false;
-  } while(c != '#');
-
-  buffer_len--;
-  pkt_len--;
-
-  // checksum, 2 bytes
-  ret = recv(m_socket_client, &check_chars[0], 1, 0);
-  if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
-    fprintf(stderr, "RSP: Error receiving checksum[0]: %s\n",
-            ret == 0 ? "Connection reset by peer" : strerror(errno));
-    return false;
-  }
-
-  ret = recv(m_socket_client, &check_chars[1], 1, 0);
-  if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
-    fprintf(stderr, "RSP: Error receiving checksum[1]: %s\n",
-            ret == 0 ? "Connection reset by peer" : strerror(errno));
-    return false;
-  }
-
-  // check the checksum
-  unsigned int checksum = 0;
-  for(int i = 0; i < buffer_len; i++) {
-    checksum += buffer[i];
   }
 
   checksum = checksum % 256;
   char checksum_str[3];
   snprintf(checksum_str, 3, "%02x", checksum);
 
-  if (check_chars[0] != checksum_str[0] || check_chars[1] != checksum_str[1]) {
-    fprintf(stderr, "RSP: Checksum failed; received %.*s; checksum should be %02x\n", pkt_len, pkt, checksum);
-    return false;
-  }
+  bool valid = m_rx_buf[end + 1] == checksum_str[0] && m_rx_buf[end + 2] == checksum_str[1];
+
+  m_rx_len -= end + 3;
+  memmove(m_rx_buf, &m_rx_buf[end + 3], m_rx_len);
 
-  // now send ACK
-  char ack = '+';
-  if (::send(m_socket_client, &ack, 1, 0) != 1) {
+  // now send ACK, or NAK to get the packet again
+  char ack = valid ? '+' : '-';
+  m_tx_mutex.lock();
+  if (!m_transport->write(&ack, 1)) {
+    m_tx_mutex.unlock();
     fprintf(stderr, "RSP: Sending ACK failed\n");
-    return false;
+    return -1;
+  }
+  m_tx_mutex.unlock();
+
+  if (!valid) {
+    fprintf(stderr, "RSP: Checksum failed; received %.*s; checksum should be %02x\n", (int)pkt_len, pkt, checksum);
+    return this->get_packet(pkt, p_pkt_len);
   }
 
   // NULL terminate the string
   pkt[pkt_len] = '\0';
   *p_pkt_len = pkt_len;
 
-  return true;
+  return 1;
 }
 
 bool
@@ -833,7 +2161,6 @@ Rsp::send_stop_reason() {
 
 bool
 Rsp::send(const char* data, size_t len) {
-  int ret;
   size_t raw_len = 0;
   char* raw = (char*)malloc(len * 2 + 4);
   unsigned int checksum = 0;
@@ -864,31 +2191,20 @@ Rsp::send(const char* data, size_t len) {
   raw[raw_len++] = checksum_str[0];
   raw[raw_len++] = checksum_str[1];
 
-  char ack;
-  do {
-    log->debug("Sending %.*s\n", raw_len, raw);
-
-    if ((size_t)::send(m_socket_client, raw, raw_len, 0) != raw_len) {
-      free(raw);
-      fprintf(stderr, "Unable to send data to client\n");
-      return false;
-    }
-
-    ret = recv(m_socket_client, &ack, 1, 0);
-    if((ret == -1 && errno != EWOULDBLOCK) || (ret == 0)) {
-      free(raw);
-      fprintf(stderr, "RSP: Error receiving\n");
-      return false;
-    }
+  log->debug("Sending %.*s\n", raw_len, raw);
 
-    if(ret == -1 && errno == EWOULDBLOCK) {
-      // no data available
-      continue;
-    }
+  // The acknowledge is consumed by get_packet together with the next incoming
+  // packet, we keep the packet around in case the client asks for it again
+  std::lock_guard<std::mutex> lock(m_tx_mutex);
+  free(m_tx_last);
+  m_tx_last = raw;
+  m_tx_last_len = raw_len;
 
-  } while (ack != '+');
+  if (!m_transport->write(raw, raw_len)) {
+    fprintf(stderr, "Unable to send data to client\n");
+    return false;
+  }
 
-  free(raw);
   return true;
 }
 
@@ -931,69 +2247,37 @@ Rsp::pc_read(unsigned int* pc) {
   return true;
 }
 
-bool
-Rsp::waitStop(DbgIF* dbgif) {
-  int ret;
-  char pkt;
-
-  fd_set rfds;
-  struct timeval tv;
-
-  while(1) {
-
-    //First check if one core has stopped
-    if (dbgif) {
-      if (dbgif->is_stopped()) {
-        return this->send_stop_reason();
-      }
-    } else {
-      for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
-        if ((*it)->is_stopped()) {
-          return this->send_stop_reason();
-        }
-      }
-    }
+void
+Rsp::runStarting(bool step) {
+  // single steps are not worth measuring, and happen in long series
+  if (step)
+    return;
 
-    // Otherwise wait for a stop request from gdb side for a while
+  if (m_perf)
+    m_perf->clear();
 
-    FD_ZERO(&rfds);
-    FD_SET(m_socket_client, &rfds);
+  m_run_stats->start();
+}
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 100 * 1000;
+void
+Rsp::runStopped() {
+  m_run_stats->stop();
 
-    if (select(m_socket_client+1, &rfds, NULL, NULL, &tv)) {
-      ret = recv(m_socket_client, &pkt, 1, 0);
-      if (ret == 1 && pkt == 0x3) {
-        if (dbgif) {
-          if (!dbgif->halt()) {
-            printf("ERROR: failed sending halt\n");
-          }
+  if (m_perf)
+    m_perf->capture();
+}
 
-          if (!dbgif->is_stopped()) {
-            printf("ERROR: failed to stop core\n");
-            return false;
-          }
+bool
+Rsp::waitStop(DbgIF* dbgif) {
+  // If the core is not stopped yet, the session thread keeps on polling it
+  // until one has stopped or a break is received from gdb
+  m_running = true;
+  m_wait_dbgif = dbgif;
 
-          return this->send_signal(TARGET_SIGNAL_INT);
-        } else {
-          for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
-            if (!(*it)->halt()) {
-              printf("ERROR: failed sending halt\n");
-            }
-
-            if (!(*it)->is_stopped()) {
-              printf("ERROR: failed to stop core\n");
-              return false;
-            }
-          }
-          return this->send_signal(TARGET_SIGNAL_INT);
-        }
-      }
-    }
-  }
+  if (m_profiler)
+    m_profiler->run_started();
 
-  return true;
+  return this->poll_stop();
 }
 
 void
@@ -1004,6 +2288,7 @@ Rsp::resumeCore(DbgIF* dbgif, bool step) {
   uint32_t npc;
 
   // now let's handle software breakpoints
+  m_bp->commit();
 
   dbgif->read(DBG_PPC_REG, &ppc);
   dbgif->read(DBG_NPC_REG, &npc);
@@ -1011,6 +2296,9 @@ Rsp::resumeCore(DbgIF* dbgif, bool step) {
   dbgif->read(DBG_CAUSE_REG, &cause);
 
 
+  this->runStarting(step);
+  m_stepping = step;
+
   // Reset single step trace hit flag before any further steps via CTRL
   dbgif->write(DBG_HIT_REG, 0);
   dbgif->write(DBG_CTRL_REG, step); // Exit debug mode
@@ -1018,59 +2306,154 @@ Rsp::resumeCore(DbgIF* dbgif, bool step) {
 
 void
 Rsp::resumeCoresPrepare(DbgIF *dbgif, bool step) {
+  // cores are resumed all together by resumeCores
+  m_resume_cmds.push_back(std::make_pair(dbgif, step));
+}
 
-  uint32_t hit;
-  uint32_t cause;
-  uint32_t ppc;
-  uint32_t npc;
+bool
+Rsp::stepOver(std::vector<DbgIF*> cores, std::vector<uint32_t> addrs) {
+  std::vector<struct mem_txn> txns;
+  std::vector<uint32_t> ctrl(cores.size());
+  uint32_t ctrl_step = 0x1;
+  bool retval = true;
 
-  // now let's handle software breakpoints
+  // take the breakpoints out of memory, with one cache flush
+  for (size_t i = 0; i < cores.size(); i++) {
+    m_bp->disable(addrs[i]);
+  }
+  m_bp->commit();
 
-  dbgif->read(DBG_PPC_REG, &ppc);
-  dbgif->read(DBG_NPC_REG, &npc);
-  dbgif->read(DBG_HIT_REG, &hit);
-  dbgif->read(DBG_CAUSE_REG, &cause);
+  // re-execute the instructions, all cores step at the same time
+  for (size_t i = 0; i < cores.size(); i++) {
+    txns.push_back(cores[i]->txn(1, DBG_NPC_REG, &addrs[i]));
+    txns.push_back(cores[i]->txn(1, DBG_CTRL_REG, &ctrl_step));
+  }
+  m_mem->access_batch(&txns[0], txns.size());
+
+  txns.clear();
+  for (size_t i = 0; i < cores.size(); i++) {
+    txns.push_back(cores[i]->txn(0, DBG_CTRL_REG, &ctrl[i]));
+  }
 
-  // if there is a breakpoint at this address, let's remove it and single-step over it
-  bool hasStepped = false;
+  std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(RSP_STEP_TIMEOUT_MS);
+  while (1) {
+    bool stopped = true;
 
-  log->debug("Preparing core to resume (step: %d, ppc: 0x%x)\n", step, ppc);
+    m_mem->access_batch(&txns[0], txns.size());
+    for (size_t i = 0; i < cores.size(); i++) {
+      if (((ctrl[i] >> 16) & 1) == 0)
+        stopped = false;
+    }
 
-  if (m_bp->at_addr(ppc)) {
-    log->debug("Core is stopped on a breakpoint, stepping to go over (addr: 0x%x)\n", ppc);
+    if (stopped)
+      break;
 
-    m_bp->disable(ppc);
-    dbgif->write(DBG_NPC_REG, ppc); // re-execute this instruction
-    dbgif->write(DBG_CTRL_REG, 0x1); // single-step
-    while (1) {
-      uint32_t value;
-      dbgif->read(DBG_CTRL_REG, &value);
-      if ((value >> 16) & 1) break;
+    if (std::chrono::steady_clock::now() > timeout) {
+      fprintf(stderr, "RSP: Cores did not step over their breakpoints in time\n");
+      retval = false;
+      break;
     }
-    m_bp->enable(ppc);
-    hasStepped = true;
   }
 
-  if (!step || !hasStepped) {
-    // clear hit register, has to be done before CTRL
-    dbgif->write(DBG_HIT_REG, 0);
-
-    if (step)
-      dbgif->write(DBG_CTRL_REG, (1<<16) | 0x1);
-    else
-      dbgif->write(DBG_CTRL_REG, (1<<16) | 0);
+  // they are written back together with the other breakpoint changes
+  for (size_t i = 0; i < cores.size(); i++) {
+    m_bp->enable(addrs[i]);
   }
+
+  return retval;
 }
 
 void
 Rsp::resumeCores() {
+  std::vector<struct mem_txn> txns;
+  std::vector<uint32_t> ppc(m_resume_cmds.size());
+  std::vector<uint32_t> hit_cause(m_resume_cmds.size() * 2);
+  std::vector<bool> stepped(m_resume_cmds.size(), false);
+  std::vector<DbgIF*> step_cores;
+  std::vector<uint32_t> step_addrs;
+  uint32_t hit = 0;
+  uint32_t ctrl_step = (1<<16) | 0x1;
+  uint32_t ctrl_cont = (1<<16) | 0;
+
+  for (size_t i = 0; i < m_resume_cmds.size(); i++) {
+    txns.push_back(m_resume_cmds[i].first->txn(0, DBG_PPC_REG, &ppc[i]));
+    txns.push_back(m_resume_cmds[i].first->txn(0, DBG_HIT_REG, &hit_cause[i * 2]));
+    txns.push_back(m_resume_cmds[i].first->txn(0, DBG_CAUSE_REG, &hit_cause[i * 2 + 1]));
+  }
+  if (txns.size())
+    m_mem->access_batch(&txns[0], txns.size());
+
+  // now let's handle software breakpoints, the cores which stopped on one
+  // are stepped over it first
+  for (size_t i = 0; i < m_resume_cmds.size(); i++) {
+    log->debug("Preparing core to resume (step: %d, ppc: 0x%x)\n", m_resume_cmds[i].second, ppc[i]);
+
+    bool on_bp = !(hit_cause[i * 2] & 0x1) && hit_cause[i * 2 + 1] == CAUSE_BREAKPOINT;
+
+    if (on_bp && m_bp->at_addr(ppc[i])) {
+      log->debug("Core is stopped on a breakpoint, stepping to go over (addr: 0x%x)\n", ppc[i]);
+      step_cores.push_back(m_resume_cmds[i].first);
+      step_addrs.push_back(ppc[i]);
+      stepped[i] = true;
+    }
+  }
+
+  if (step_cores.size())
+    this->stepOver(step_cores, step_addrs);
+
+  bool step_only = true;
+  for (size_t i = 0; i < m_resume_cmds.size(); i++) {
+    if (!m_resume_cmds[i].second)
+      step_only = false;
+  }
+  this->runStarting(step_only);
+
+  m_stepping = false;
+  for (size_t i = 0; i < m_resume_cmds.size(); i++) {
+    if (m_resume_cmds[i].second)
+      m_stepping = true;
+  }
+
+  txns.clear();
+  for (size_t i = 0; i < m_resume_cmds.size(); i++) {
+    bool step = m_resume_cmds[i].second;
+    if (step && stepped[i])
+      continue;
+
+    // clear hit register, has to be done before CTRL
+    txns.push_back(m_resume_cmds[i].first->txn(1, DBG_HIT_REG, &hit));
+    txns.push_back(m_resume_cmds[i].first->txn(1, DBG_CTRL_REG, step ? &ctrl_step : &ctrl_cont));
+  }
+  if (txns.size())
+    m_mem->access_batch(&txns[0], txns.size());
+
+  m_resume_cmds.clear();
+
+  // write all pending breakpoint changes, with a single cache flush
+  m_bp->commit();
+
   if (m_dbgifs.size() == 1) {
     uint32_t value;
-    this->get_dbgif(0)->read(DBG_CTRL_REG, &value);
-    this->get_dbgif(0)->write(DBG_CTRL_REG, value & ~(1<<16));
+    m_dbgifs.front()->read(DBG_CTRL_REG, &value);
+    m_dbgifs.front()->write(DBG_CTRL_REG, value & ~(1<<16));
   } else {
-    uint32_t info = 0xFFFFFFFF;
-    m_mem->access(1, 0x10200028, 4, (char*)&info);
+    // Cluster cores are resumed together through the cluster controller,
+    // which only touches the cores owned by this client. Other cores (e.g.
+    // the fabric controller, cluster id 32) are resumed directly.
+    uint32_t info = 0;
+    for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+      unsigned int thread_id = (*it)->get_thread_id();
+      if ((thread_id >> 5) < 32) {
+        info |= 1 << (thread_id & 0x1F);
+      } else {
+        uint32_t value;
+        (*it)->read(DBG_CTRL_REG, &value);
+        (*it)->write(DBG_CTRL_REG, value & ~(1<<16));
+      }
+    }
+
+    if (info)
+      m_mem->access(1, CLUSTER_RESUME_REG, 4, (char*)&info);
   }
 }
 
@@ -1114,9 +2497,10 @@ Rsp::mem_read(char* data, size_t len) {
   }
 
   m_mem->access(0, addr, length, buffer);
+  m_bp->hide(addr, length, buffer);
 
   for(unsigned int i = 0; i < length; i++) {
-    rdata = buffer[i];
+    rdata = (uint8_t)buffer[i];
     snprintf(&reply[i * 2], 3, "%02x", rdata);
   }
 
@@ -1170,13 +2554,16 @@ Rsp::mem_write_ascii(char* data, size_t len) {
       else if (c >= 'A' && c <= 'F')
         hex = c - 'A' + 10;
 
-      wdata |= hex << (4 * i);
+      // the first digit is the high nibble
+      wdata |= hex << (4 * (1 - i));
     }
 
     buffer[j] = wdata;
   }
 
   m_mem->access(1, addr, buffer_len, buffer);
+  m_bp->written(addr, buffer_len, buffer);
+  m_server->get_loader()->written(addr, buffer_len);
 
   free(buffer);
 
@@ -1208,6 +2595,8 @@ Rsp::mem_write(char* data, size_t len) {
   len = len - i - 1;
 
   m_mem->access(1, addr, len, data);
+  m_bp->written(addr, len, data);
+  m_server->get_loader()->written(addr, len);
 
   return this->send_str("OK");
 }
@@ -1231,6 +2620,7 @@ Rsp::bp_insert(char* data, size_t len) {
   }
 
   m_bp->insert(addr);
+  m_bp_addrs.insert(addr);
 
   return this->send_str("OK");
 }
@@ -1257,6 +2647,11 @@ Rsp::bp_remove(char* data, size_t len) {
     return this->send_str("");
   }
 
+  std::multiset<unsigned int>::iterator it = m_bp_addrs.find(addr);
+  if (it == m_bp_addrs.end())
+    return this->send_str("E01");
+
+  m_bp_addrs.erase(it);
   m_bp->remove(addr);
 
   // check if we are currently on this bp that is removed
@@ -1270,12 +2665,10 @@ Rsp::bp_remove(char* data, size_t len) {
 
 DbgIF*
 Rsp::get_dbgif(unsigned int thread_id) {
-  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
-    if ((*it)->get_thread_id() == thread_id)
-      return *it;
-  }
+  if (thread_id >= m_dbgif_by_tid.size())
+    return NULL;
 
-  return NULL;
+  return m_dbgif_by_tid[thread_id];
 }
 
 bool
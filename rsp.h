@@ -2,10 +2,19 @@
 #define RSP_H
 
 #include "mem.h"
+#include "mem_queue.h"
 #include "debug_if.h"
 #include "breakpoints.h"
+#include "reactor.h"
+#include "transport.h"
 
 #include <list>
+#include <vector>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -17,16 +26,44 @@
 #include <string.h>
 #include <sys/select.h>
 
+#define PACKET_MAX_LEN 4096
 
-class Rsp {
+// Interval in ms at which running cores are polled to see if they stopped
+#define RSP_POLL_MS 100
+
+// Time in ms given to the cores to step over their breakpoints on resume
+#define RSP_STEP_TIMEOUT_MS 1000
+
+// Steps of a recorded run between two looks at the packets and breaks
+#define RSP_RECORD_STEPS 256
+
+// gdb register number of the first CSR, CSRs are accessed with p/P packets
+#define RSP_FIRST_CSR 65
+
+class RspServer;
+class Profiler;
+class PerfCounters;
+class RunStats;
+class Semihost;
+class Watch;
+class Coverage;
+class Record;
+
+// One GDB session, bound to a subset of the cores of the target.
+// The reactor thread receives the packets and handles breaks right away,
+// while the packets themselves are executed by a session thread, so that a
+// long target access never delays a break.
+class Rsp : public EventHandler {
   public:
-    Rsp(int socket_port, MemIF* mem, LogIF *log, std::list<DbgIF*> list_dbgif, BreakPoints* bp);
+    Rsp(RspServer* server, Transport* transport, MemQueue* mem, LogIF *log, BreakPoints* bp);
+    ~Rsp();
 
-    bool open();
-    void close();
+    void set_cores(std::list<DbgIF*> list_dbgif);
+    void start();
 
-    bool wait_client();
-    bool loop();
+    int get_fd() { return m_transport->get_fd(); }
+    bool readable();
+    void closed();
 
   private:
     enum target_signal {
@@ -45,6 +82,23 @@ class Rsp {
       TARGET_SIGNAL_LAST,
     };
 
+    struct rsp_packet {
+      char* data;
+      size_t len;
+    };
+
+    void run();
+    void interrupt();
+    bool poll_stop();
+    bool profile_sample();
+    bool coreStopped(DbgIF* stopped);
+    bool semihost(bool* handled);
+    bool coverage(bool* handled);
+    bool resumeRunning(std::list<DbgIF*>* cores, std::vector<struct mem_txn>* txns);
+    bool record_steps();
+    bool resumeRecorded(bool step);
+    bool reverse(bool cont);
+
     bool decode(char* data, size_t len);
 
     bool multithread(char* data, size_t len);
@@ -61,7 +115,7 @@ class Rsp {
     bool reg_read(char* data, size_t len);
     bool reg_write(char* data, size_t len);
 
-    bool get_packet(char* data, size_t* len);
+    int get_packet(char* data, size_t* len);
 
 
     bool send(const char* data, size_t len);
@@ -71,12 +125,15 @@ class Rsp {
     // internal helper functions
     bool pc_read(unsigned int* pc);
 
+    void runStarting(bool step);
+    void runStopped();
     bool waitStop(DbgIF* dbgif);
     bool resume(bool step);
     bool resume(int tid, bool step);
     void resumeCore(DbgIF* dbgif, bool step);
     void resumeCoresPrepare(DbgIF *dbgif, bool step);
     void resumeCores();
+    bool stepOver(std::vector<DbgIF*> cores, std::vector<uint32_t> addrs);
 
     bool mem_read(char* data, size_t len);
     bool mem_write_ascii(char* data, size_t len);
@@ -88,20 +145,86 @@ class Rsp {
     bool reset(bool halt);
 
     bool monitor_help(char *str, size_t len);
+    bool monitor_cores(char *str, size_t len);
+    bool monitor_memstats(char *str, size_t len);
+    bool monitor_load(char *str, size_t len);
+    bool monitor_memops(char *str, size_t len);
+    bool monitor_checkpoint(char *str, size_t len);
+    bool monitor_profile(char *str, size_t len);
+    bool monitor_perf(char *str, size_t len);
+    bool monitor_watch(char *str, size_t len);
+    bool monitor_coverage(char *str, size_t len);
+    bool monitor_trace(char *str, size_t len);
+    bool monitor_record(char *str, size_t len);
+    bool monitor_lockstep(char *str, size_t len);
+    bool monitor_reply(const char *str, ...);
 
     bool encode_hex(const char *in, char *out, size_t out_len);
 
     DbgIF* get_dbgif(unsigned int thread_id);
 
-    int m_socket_port;
-    int m_socket_in;
-    int m_socket_client;
+    RspServer* m_server;
+    Transport* m_transport;
+
+    // received bytes which do not form a complete packet yet
+    char m_rx_buf[PACKET_MAX_LEN + 4];
+    size_t m_rx_len;
+
+    // last packet sent, kept until the next one in case the client NAKs it
+    char* m_tx_last;
+    size_t m_tx_last_len;
+    std::mutex m_tx_mutex;
+
+    // session thread and the packets waiting for it
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::list<struct rsp_packet> m_packets;
+    bool m_break;
+    bool m_stop;
+
+    // set while the cores are running and we are waiting for them to stop
+    bool m_running;
+    DbgIF* m_wait_dbgif;
+    // a core of the run was single-stepped, it is then polled, not sampled,
+    // as halting it would cancel the step
+    bool m_stepping;
+
+    // PC sampling, done by the session thread instead of polling while the
+    // cores are running
+    Profiler* m_profiler;
+
+    // hardware event counters, read at the end of each run
+    PerfCounters* m_perf;
+
+    // cycles and host time of each run
+    RunStats* m_run_stats;
+
+    // serves the semihosting calls of the cores when set
+    Semihost* m_semihost;
+
+    // variables sampled while the cores run
+    Watch* m_watch;
+
+    // one-shot breakpoints at the blocks not covered yet, handled without
+    // reporting them to gdb
+    Coverage* m_coverage;
+
+    // execution log of the selected core, the cores are stepped by the bridge
+    // instead of running while it is set
+    Record* m_record;
 
     int m_thread_sel;
-    MemIF* m_mem;
+    MemQueue* m_mem;
     LogIF *log;
     BreakPoints* m_bp;
     std::list<DbgIF*> m_dbgifs;
+    // m_dbgifs indexed by thread id, for the lookups done on every packet
+    std::vector<DbgIF*> m_dbgif_by_tid;
+    std::multiset<unsigned int> m_bp_addrs;
+
+    // cores to resume with the next resumeCores, and whether they single-step
+    std::vector<std::pair<DbgIF*, bool> > m_resume_cmds;
 };
 
 #endif
@@ -0,0 +1,296 @@
+
+#include "rsp_server.h"
+#include "rsp.h"
+
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <algorithm>
+
+RspServer::RspServer(MemQueue* mem, LogIF *log, std::list<DbgIF*> list_dbgif, BreakPoints* bp, Loader* loader, Checkpoint* checkpoint, Rtt* rtt) {
+  m_socket_port = -1;
+  m_socket_in = -1;
+  m_unix_path = NULL;
+  m_stdin_is_rsp = false;
+  m_reactor = NULL;
+  m_mem = mem;
+  m_dbgifs = list_dbgif;
+  m_bp = bp;
+  m_loader = loader;
+  m_checkpoint = checkpoint;
+  m_rtt = rtt;
+  this->log = log;
+
+  if (m_dbgifs.size() == 0) {
+    fprintf(stderr, "No debug interface available! Exiting now\n");
+    exit(1);
+  }
+}
+
+RspServer::~RspServer() {
+  this->close();
+}
+
+bool
+RspServer::open(Reactor* reactor, int socket_port) {
+  struct sockaddr_in addr;
+  int yes = 1;
+
+  m_socket_port = socket_port;
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(m_socket_port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  memset(addr.sin_zero, '\0', sizeof(addr.sin_zero));
+
+  m_socket_in = socket(PF_INET, SOCK_STREAM, 0);
+  if(m_socket_in < 0)
+  {
+    fprintf(stderr, "Unable to create comm socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  if(setsockopt(m_socket_in, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
+    fprintf(stderr, "Unable to setsockopt on the socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  if(::bind(m_socket_in, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Unable to bind the socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  if(listen(m_socket_in, 8) == -1) {
+    fprintf(stderr, "Unable to listen: %s\n", strerror(errno));
+    return false;
+  }
+
+  m_reactor = reactor;
+  if (!m_reactor->add(this))
+    return false;
+
+  fprintf(stderr, "Debug bridge listening on port %d\n", m_socket_port);
+
+  return true;
+}
+
+bool
+RspServer::open_unix(Reactor* reactor, const char* path) {
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Unix socket path is too long: %s\n", path);
+    return false;
+  }
+
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  m_socket_in = socket(PF_UNIX, SOCK_STREAM, 0);
+  if(m_socket_in < 0)
+  {
+    fprintf(stderr, "Unable to create comm socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  // remove a stale socket from a previous run
+  unlink(path);
+
+  if(::bind(m_socket_in, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "Unable to bind the socket: %s\n", strerror(errno));
+    return false;
+  }
+
+  m_unix_path = strdup(path);
+
+  if(listen(m_socket_in, 8) == -1) {
+    fprintf(stderr, "Unable to listen: %s\n", strerror(errno));
+    return false;
+  }
+
+  m_reactor = reactor;
+  if (!m_reactor->add(this))
+    return false;
+
+  fprintf(stderr, "Debug bridge listening on %s\n", path);
+
+  return true;
+}
+
+bool
+RspServer::open_pipe(Reactor* reactor, int fd_in, int fd_out) {
+  // There is exactly one client, which is connected from the start. Once it
+  // goes away, the reactor has nothing left to do.
+  m_reactor = reactor;
+  m_stdin_is_rsp = fd_in == 0;
+  return this->connect(new PipeTransport(fd_in, fd_out));
+}
+
+void
+RspServer::close() {
+  // closing a client calls back into release, thus work on a copy
+  std::list<Rsp*> clients = m_clients;
+  for (std::list<Rsp*>::iterator it = clients.begin(); it != clients.end(); it++) {
+    m_reactor->remove(*it);
+  }
+
+  if (m_socket_in != -1) {
+    if (m_reactor)
+      m_reactor->remove(this);
+
+    ::close(m_socket_in);
+    m_socket_in = -1;
+  }
+
+  if (m_unix_path) {
+    unlink(m_unix_path);
+    free(m_unix_path);
+    m_unix_path = NULL;
+  }
+
+  m_reactor = NULL;
+}
+
+bool
+RspServer::readable() {
+  int socket_client;
+  int yes = 1;
+
+  if((socket_client = accept(m_socket_in, NULL, NULL)) == -1) {
+    if(errno == EAGAIN || errno == EINTR)
+      return true;
+
+    fprintf(stderr, "Unable to accept connection: %s\n", strerror(errno));
+    return true;
+  }
+
+  // RSP is a ping-pong protocol, don't let small packets linger
+  if (m_unix_path == NULL)
+    setsockopt(socket_client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+
+  this->connect(new SocketTransport(socket_client));
+  return true;
+}
+
+bool
+RspServer::connect(Transport* transport) {
+  Rsp* client = new Rsp(this, transport, m_mem, log, m_bp);
+
+  std::list<DbgIF*> cores;
+  if (!this->claim(client, &cores)) {
+    fprintf(stderr, "RSP: No free cores left, rejecting client\n");
+    delete client;
+    return false;
+  }
+
+  client->set_cores(cores);
+  m_clients.push_back(client);
+
+  if (!m_reactor->add(client)) {
+    this->release(client);
+    return false;
+  }
+
+  client->start();
+
+  log->debug("RSP: Client connected!\n");
+  return true;
+}
+
+bool
+RspServer::claim(Rsp* client, std::list<DbgIF*>* cores) {
+  std::lock_guard<std::mutex> lock(m_owners_mutex);
+
+  // Cores are grouped by cluster id, the first cluster which is completely
+  // free is given to the client
+  for (std::list<DbgIF*>::iterator it = m_dbgifs.begin(); it != m_dbgifs.end(); it++) {
+    unsigned int cluster = (*it)->get_thread_id() >> 5;
+    bool free = true;
+
+    cores->clear();
+    for (std::list<DbgIF*>::iterator core = m_dbgifs.begin(); core != m_dbgifs.end(); core++) {
+      if (((*core)->get_thread_id() >> 5) != cluster)
+        continue;
+
+      if (m_owners.count((*core)->get_thread_id())) {
+        free = false;
+        break;
+      }
+
+      cores->push_back(*core);
+    }
+
+    if (free) {
+      for (std::list<DbgIF*>::iterator core = cores->begin(); core != cores->end(); core++) {
+        m_owners[(*core)->get_thread_id()] = client;
+      }
+      return true;
+    }
+  }
+
+  cores->clear();
+  return false;
+}
+
+bool
+RspServer::bind_cores(Rsp* client, std::list<unsigned int> thread_ids, std::list<DbgIF*>* cores) {
+  std::lock_guard<std::mutex> lock(m_owners_mutex);
+
+  cores->clear();
+
+  for (std::list<unsigned int>::iterator it = thread_ids.begin(); it != thread_ids.end(); it++) {
+    DbgIF* dbgif = NULL;
+
+    for (std::list<DbgIF*>::iterator core = m_dbgifs.begin(); core != m_dbgifs.end(); core++) {
+      if ((*core)->get_thread_id() == *it)
+        dbgif = *core;
+    }
+
+    if (dbgif == NULL) {
+      fprintf(stderr, "RSP: Core %X does not exist\n", *it);
+      return false;
+    }
+
+    std::map<unsigned int, Rsp*>::iterator owner = m_owners.find(*it);
+    if (owner != m_owners.end() && owner->second != client) {
+      fprintf(stderr, "RSP: Core %X is already owned by another client\n", *it);
+      return false;
+    }
+
+    cores->push_back(dbgif);
+  }
+
+  if (cores->size() == 0)
+    return false;
+
+  // drop all previously owned cores and take the new ones
+  for (std::map<unsigned int, Rsp*>::iterator it = m_owners.begin(); it != m_owners.end();) {
+    if (it->second == client)
+      m_owners.erase(it++);
+    else
+      it++;
+  }
+
+  for (std::list<DbgIF*>::iterator core = cores->begin(); core != cores->end(); core++) {
+    m_owners[(*core)->get_thread_id()] = client;
+  }
+
+  return true;
+}
+
+void
+RspServer::release(Rsp* client) {
+  std::list<Rsp*>::iterator it = std::find(m_clients.begin(), m_clients.end(), client);
+  if (it != m_clients.end())
+    m_clients.erase(it);
+
+  // the session thread must be gone before its cores are given to others
+  delete client;
+
+  std::lock_guard<std::mutex> lock(m_owners_mutex);
+  for (std::map<unsigned int, Rsp*>::iterator it = m_owners.begin(); it != m_owners.end();) {
+    if (it->second == client)
+      m_owners.erase(it++);
+    else
+      it++;
+  }
+}
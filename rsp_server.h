@@ -0,0 +1,70 @@
+#ifndef RSP_SERVER_H
+#define RSP_SERVER_H
+
+#include "mem.h"
+#include "mem_queue.h"
+#include "debug_if.h"
+#include "breakpoints.h"
+#include "reactor.h"
+#include "log.h"
+#include "transport.h"
+#include "loader.h"
+#include "checkpoint.h"
+#include "rtt.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+
+class Rsp;
+
+// Listens for GDB connections, on a TCP port, a Unix domain socket or a pipe
+// pair, and hands out the cores of the target to the connected clients. Each
+// client owns a disjoint set of cores, by default a complete cluster (e.g. the
+// fabric controller or the cluster on GAP).
+class RspServer : public EventHandler {
+  public:
+    RspServer(MemQueue* mem, LogIF *log, std::list<DbgIF*> list_dbgif, BreakPoints* bp, Loader* loader, Checkpoint* checkpoint, Rtt* rtt);
+    ~RspServer();
+
+    bool open(Reactor* reactor, int socket_port);
+    bool open_unix(Reactor* reactor, const char* path);
+    bool open_pipe(Reactor* reactor, int fd_in, int fd_out);
+    void close();
+
+    int get_fd() { return m_socket_in; }
+    bool readable();
+
+    Loader* get_loader() { return m_loader; }
+    Checkpoint* get_checkpoint() { return m_checkpoint; }
+    Rtt* get_rtt() { return m_rtt; }
+
+    // stdin carries the packets of gdb, it can not be read by the target
+    bool stdin_is_rsp() { return m_stdin_is_rsp; }
+
+    bool bind_cores(Rsp* client, std::list<unsigned int> thread_ids, std::list<DbgIF*>* cores);
+    void release(Rsp* client);
+
+  private:
+    bool connect(Transport* transport);
+    bool claim(Rsp* client, std::list<DbgIF*>* cores);
+
+    int m_socket_port;
+    int m_socket_in;
+    char* m_unix_path;
+    bool m_stdin_is_rsp;
+
+    Reactor* m_reactor;
+    MemQueue* m_mem;
+    LogIF *log;
+    BreakPoints* m_bp;
+    Loader* m_loader;
+    Checkpoint* m_checkpoint;
+    Rtt* m_rtt;
+    std::list<DbgIF*> m_dbgifs;
+    std::list<Rsp*> m_clients;
+    std::map<unsigned int, Rsp*> m_owners;
+    std::mutex m_owners_mutex;
+};
+
+#endif
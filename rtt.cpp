@@ -0,0 +1,487 @@
+
+#include "rtt.h"
+#include "mem_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// identifier and number of up and down buffers
+#define HEADER_SIZE (RTT_ID_LEN + 8)
+
+Rtt::Rtt(MemIF* mem) {
+  m_mem = mem;
+  m_addr = 0;
+  m_cb = 0;
+  m_nb_up = 0;
+  m_nb_down = 0;
+  m_started = false;
+  m_stop = false;
+}
+
+Rtt::~Rtt() {
+  this->stop();
+
+  for (std::list<struct channel>::iterator it = m_channels.begin(); it != m_channels.end(); it++) {
+    if (it->fd != -1)
+      close(it->fd);
+
+    if (it->listen_fd != -1)
+      close(it->listen_fd);
+
+    if (it->unix_path) {
+      unlink(it->unix_path);
+      free(it->unix_path);
+    }
+  }
+}
+
+void
+Rtt::add_region(uint32_t addr, uint32_t len) {
+  m_regions.push_back(std::make_pair(addr, len));
+}
+
+bool
+Rtt::add_channel(unsigned int index, const char* output) {
+  struct channel channel = { index, -1, -1, NULL, 0, 0 };
+  int yes = 1;
+
+  for (std::list<struct channel>::iterator it = m_channels.begin(); it != m_channels.end(); it++) {
+    if (it->index == index) {
+      fprintf(stderr, "RTT: Channel %u has already an output\n", index);
+      return false;
+    }
+  }
+
+  if (strncmp(output, "tcp:", 4) == 0) {
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(output + 4));
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    channel.listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (channel.listen_fd != -1)
+      setsockopt(channel.listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+    if (channel.listen_fd == -1 || ::bind(channel.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      fprintf(stderr, "RTT: Unable to bind %s: %s\n", output, strerror(errno));
+      if (channel.listen_fd != -1)
+        close(channel.listen_fd);
+      return false;
+    }
+  } else if (strncmp(output, "unix:", 5) == 0) {
+    struct sockaddr_un addr;
+
+    if (strlen(output + 5) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "RTT: Unix socket path is too long: %s\n", output + 5);
+      return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, output + 5);
+
+    // remove a stale socket from a previous run
+    unlink(addr.sun_path);
+
+    channel.listen_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (channel.listen_fd == -1 || ::bind(channel.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      fprintf(stderr, "RTT: Unable to bind %s: %s\n", output, strerror(errno));
+      if (channel.listen_fd != -1)
+        close(channel.listen_fd);
+      return false;
+    }
+
+    channel.unix_path = strdup(addr.sun_path);
+  } else {
+    channel.fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (channel.fd == -1) {
+      fprintf(stderr, "RTT: Unable to open %s: %s\n", output, strerror(errno));
+      return false;
+    }
+  }
+
+  // clients are accepted by the polling thread, which must never block on it
+  if (channel.listen_fd != -1) {
+    if (listen(channel.listen_fd, 1) == -1 || fcntl(channel.listen_fd, F_SETFL, O_NONBLOCK) == -1) {
+      fprintf(stderr, "RTT: Unable to listen on %s: %s\n", output, strerror(errno));
+      close(channel.listen_fd);
+      if (channel.unix_path) {
+        unlink(channel.unix_path);
+        free(channel.unix_path);
+      }
+      return false;
+    }
+  }
+
+  m_channels.push_back(channel);
+  return true;
+}
+
+bool
+Rtt::start() {
+  if (m_started)
+    return true;
+
+  if (m_addr == 0 && m_regions.empty()) {
+    fprintf(stderr, "RTT: No address and no memory to scan for the control block\n");
+    return false;
+  }
+
+  m_stop = false;
+  m_started = true;
+  m_thread = std::thread(&Rtt::run, this);
+  return true;
+}
+
+void
+Rtt::stop() {
+  if (!m_started)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+
+  m_thread.join();
+  m_started = false;
+}
+
+void
+Rtt::run() {
+  // polling must not delay what gdb is waiting for
+  MemQueue::set_class(MEM_CLASS_BULK);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (!m_stop) {
+    unsigned int wait_ms = RTT_POLL_MS;
+    bool moved = false;
+    uint32_t cb = m_cb;
+
+    lock.unlock();
+
+    if (cb == 0) {
+      if (!this->locate(&cb)) {
+        cb = 0;
+        wait_ms = RTT_SCAN_MS;
+      } else {
+        fprintf(stderr, "RTT: Control block at 0x%08X, %u up and %u down buffers\n", cb, m_nb_up, m_nb_down);
+      }
+    } else if (!this->poll(&moved)) {
+      // e.g. the target was reset or another program was loaded
+      fprintf(stderr, "RTT: Lost the control block at 0x%08X\n", cb);
+      cb = 0;
+    }
+
+    lock.lock();
+    m_cb = cb;
+
+    // as long as there is data, the buffers are drained back to back
+    if (!moved)
+      m_cond.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return m_stop; });
+  }
+}
+
+bool
+Rtt::check(uint32_t addr) {
+  char header[HEADER_SIZE];
+  uint32_t nb_up, nb_down;
+
+  if (!m_mem->access(0, addr, HEADER_SIZE, header))
+    return false;
+
+  memcpy(&nb_up, &header[RTT_ID_LEN], 4);
+  memcpy(&nb_down, &header[RTT_ID_LEN + 4], 4);
+
+  if (memcmp(header, RTT_ID, sizeof(RTT_ID)) != 0 || nb_up == 0 || nb_up > RTT_MAX_BUFFERS || nb_down > RTT_MAX_BUFFERS)
+    return false;
+
+  m_nb_up = nb_up;
+  m_nb_down = nb_down;
+  return true;
+}
+
+bool
+Rtt::locate(uint32_t* cb) {
+  std::vector<char> slice(RTT_SCAN_SLICE);
+
+  // the target may not have set up the control block yet
+  if (m_addr != 0) {
+    *cb = m_addr;
+    return this->check(m_addr);
+  }
+
+  for (std::list<std::pair<uint32_t, uint32_t> >::iterator it = m_regions.begin(); it != m_regions.end(); it++) {
+    uint32_t offset = 0;
+
+    while (offset + HEADER_SIZE <= it->second) {
+      uint32_t len = it->second - offset;
+      if (len > RTT_SCAN_SLICE)
+        len = RTT_SCAN_SLICE;
+
+      if (!m_mem->access(0, it->first + offset, len, &slice[0]))
+        break;
+
+      // the control block is word aligned, the identifier is followed by
+      // plausible buffer counts
+      for (uint32_t i = 0; i + sizeof(RTT_ID) <= len; i += 4) {
+        if (memcmp(&slice[i], RTT_ID, sizeof(RTT_ID)) == 0 && this->check(it->first + offset + i)) {
+          *cb = it->first + offset + i;
+          return true;
+        }
+      }
+
+      // slices overlap so that an identifier cut in two is not missed
+      if (len < RTT_SCAN_SLICE)
+        break;
+      offset += RTT_SCAN_SLICE - RTT_ID_LEN;
+    }
+  }
+
+  return false;
+}
+
+bool
+Rtt::poll(bool* moved) {
+  char header[HEADER_SIZE];
+  uint32_t nb_up, nb_down;
+
+  // one batch for the header and all buffer descriptors
+  m_descs.resize(m_nb_up + m_nb_down);
+
+  struct mem_txn txns[2] = {
+    { 0, m_cb, HEADER_SIZE, header },
+    { 0, m_cb + HEADER_SIZE, (int)(m_descs.size() * sizeof(struct buffer_desc)), (char*)&m_descs[0] },
+  };
+
+  if (!m_mem->access_batch(txns, 2))
+    return false;
+
+  memcpy(&nb_up, &header[RTT_ID_LEN], 4);
+  memcpy(&nb_down, &header[RTT_ID_LEN + 4], 4);
+
+  if (memcmp(header, RTT_ID, sizeof(RTT_ID)) != 0 || nb_up != m_nb_up || nb_down != m_nb_down)
+    return false;
+
+  for (std::list<struct channel>::iterator it = m_channels.begin(); it != m_channels.end(); it++) {
+    this->accept_client(&*it);
+
+    if (it->index < m_nb_up) {
+      uint32_t desc_addr = m_cb + HEADER_SIZE + it->index * sizeof(struct buffer_desc);
+      if (!this->drain(&*it, &m_descs[it->index], desc_addr, moved))
+        return false;
+    }
+
+    if (it->index < m_nb_down) {
+      uint32_t desc_addr = m_cb + HEADER_SIZE + (m_nb_up + it->index) * sizeof(struct buffer_desc);
+      if (!this->fill(&*it, &m_descs[m_nb_up + it->index], desc_addr, moved))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+Rtt::valid(struct buffer_desc* desc) {
+  // not set up by the target yet, or overwritten
+  if (desc->size == 0 || desc->wr_off >= desc->size || desc->rd_off >= desc->size)
+    return false;
+
+  // an address given on an unknown chip, there is no memory map to check
+  if (m_regions.empty())
+    return true;
+
+  for (std::list<std::pair<uint32_t, uint32_t> >::iterator it = m_regions.begin(); it != m_regions.end(); it++) {
+    if (desc->buffer >= it->first && (uint64_t)desc->buffer + desc->size <= (uint64_t)it->first + it->second)
+      return true;
+  }
+
+  return false;
+}
+
+bool
+Rtt::drain(struct channel* channel, struct buffer_desc* desc, uint32_t desc_addr, bool* moved) {
+  // without a client the data stays in the target, which may block or drop
+  // depending on the mode of the buffer
+  if (channel->fd == -1)
+    return true;
+
+  if (!this->valid(desc) || desc->wr_off == desc->rd_off)
+    return true;
+
+  // up to the write offset, in two parts if it wrapped around
+  uint32_t first = desc->wr_off > desc->rd_off ? desc->wr_off - desc->rd_off : desc->size - desc->rd_off;
+  uint32_t second = desc->wr_off > desc->rd_off ? 0 : desc->wr_off;
+
+  // at most one slice per poll, so that the batch does not hold the queue,
+  // the rest is drained by the next poll right after
+  if (first > MEM_QUEUE_SLICE)
+    first = MEM_QUEUE_SLICE;
+  if (second > MEM_QUEUE_SLICE - first)
+    second = MEM_QUEUE_SLICE - first;
+
+  uint32_t rd_off = (desc->rd_off + first + second) % desc->size;
+
+  m_data.resize(first + second);
+
+  // the data is read before the read offset frees the space
+  struct mem_txn txns[3];
+  int nb_txns = 0;
+
+  txns[nb_txns++] = (struct mem_txn){ 0, desc->buffer + desc->rd_off, (int)first, &m_data[0] };
+  if (second)
+    txns[nb_txns++] = (struct mem_txn){ 0, desc->buffer, (int)second, &m_data[first] };
+  txns[nb_txns++] = (struct mem_txn){ 1, desc_addr + (uint32_t)offsetof(struct buffer_desc, rd_off), 4, (char*)&rd_off };
+
+  if (!m_mem->access_batch(txns, nb_txns))
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    channel->up_bytes += first + second;
+  }
+
+  *moved = true;
+  this->forward(channel, &m_data[0], first + second);
+  return true;
+}
+
+bool
+Rtt::fill(struct channel* channel, struct buffer_desc* desc, uint32_t desc_addr, bool* moved) {
+  if (channel->listen_fd == -1 || channel->fd == -1)
+    return true;
+
+  if (!this->valid(desc))
+    return true;
+
+  // one byte is kept free to tell a full buffer from an empty one
+  uint32_t room = desc->rd_off > desc->wr_off ? desc->rd_off - desc->wr_off - 1 : desc->size - desc->wr_off + desc->rd_off - 1;
+  if (room == 0)
+    return true;
+
+  if (room > MEM_QUEUE_SLICE)
+    room = MEM_QUEUE_SLICE;
+
+  m_data.resize(room);
+
+  ssize_t len = recv(channel->fd, &m_data[0], room, MSG_DONTWAIT);
+  if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return true;
+
+  if (len <= 0) {
+    fprintf(stderr, "RTT: Client of channel %u disconnected\n", channel->index);
+    close(channel->fd);
+    channel->fd = -1;
+    return true;
+  }
+
+  uint32_t first = (uint32_t)len < desc->size - desc->wr_off ? (uint32_t)len : desc->size - desc->wr_off;
+  uint32_t second = len - first;
+  uint32_t wr_off = (desc->wr_off + len) % desc->size;
+
+  // the data is written before the write offset makes it visible
+  struct mem_txn txns[3];
+  int nb_txns = 0;
+
+  txns[nb_txns++] = (struct mem_txn){ 1, desc->buffer + desc->wr_off, (int)first, &m_data[0] };
+  if (second)
+    txns[nb_txns++] = (struct mem_txn){ 1, desc->buffer, (int)second, &m_data[first] };
+  txns[nb_txns++] = (struct mem_txn){ 1, desc_addr + (uint32_t)offsetof(struct buffer_desc, wr_off), 4, (char*)&wr_off };
+
+  if (!m_mem->access_batch(txns, nb_txns))
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    channel->down_bytes += len;
+  }
+
+  *moved = true;
+  return true;
+}
+
+void
+Rtt::accept_client(struct channel* channel) {
+  int yes = 1;
+
+  if (channel->listen_fd == -1)
+    return;
+
+  int fd = accept(channel->listen_fd, NULL, NULL);
+  if (fd == -1)
+    return;
+
+  // the last client to connect gets the channel
+  if (channel->fd != -1)
+    close(channel->fd);
+
+  if (channel->unix_path == NULL)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+
+  fprintf(stderr, "RTT: Client connected to channel %u\n", channel->index);
+  channel->fd = fd;
+}
+
+bool
+Rtt::forward(struct channel* channel, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t ret;
+
+    if (channel->listen_fd != -1)
+      ret = send(channel->fd, data, len, MSG_NOSIGNAL);
+    else
+      ret = write(channel->fd, data, len);
+
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+
+      fprintf(stderr, "RTT: Unable to forward channel %u: %s\n", channel->index, strerror(errno));
+
+      // a file is kept, a client has to reconnect
+      if (channel->listen_fd != -1) {
+        close(channel->fd);
+        channel->fd = -1;
+      }
+      return false;
+    }
+
+    data += ret;
+    len  -= ret;
+  }
+
+  return true;
+}
+
+void
+Rtt::get_report(char* str, size_t len) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  int pos;
+
+  if (!m_started)
+    pos = snprintf(str, len, "RTT is not enabled\n");
+  else if (m_cb == 0 && m_addr != 0)
+    pos = snprintf(str, len, "No RTT control block at 0x%08X yet\n", m_addr);
+  else if (m_cb == 0)
+    pos = snprintf(str, len, "Searching for the RTT control block\n");
+  else
+    pos = snprintf(str, len, "RTT control block at 0x%08X, %u up and %u down buffers\n", m_cb, m_nb_up, m_nb_down);
+
+  for (std::list<struct channel>::iterator it = m_channels.begin(); it != m_channels.end() && pos < (int)len; it++) {
+    pos += snprintf(&str[pos], len - pos, "  Channel %u: %llu bytes up, %llu bytes down%s\n",
+      it->index, it->up_bytes, it->down_bytes, it->listen_fd != -1 && it->fd == -1 ? ", no client" : "");
+  }
+}
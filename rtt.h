@@ -0,0 +1,108 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include "mem.h"
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Identifier at the start of the control block
+#define RTT_ID "SEGGER RTT"
+#define RTT_ID_LEN 16
+
+// Sanity bound on the number of buffers of a control block
+#define RTT_MAX_BUFFERS 16
+
+// Interval in ms at which the buffers are polled when there was nothing to
+// move, and at which the control block is searched until it is found
+#define RTT_POLL_MS 10
+#define RTT_SCAN_MS 1000
+
+// Memory is scanned for the control block in slices of this size
+#define RTT_SCAN_SLICE 65536
+
+// Moves data between the host and ring buffers in the memory of the running
+// target, as SEGGER RTT does. The target sets up a control block holding the
+// up (target to host) and down (host to target) buffers, which is found
+// through its address, e.g. the one of the _SEGGER_RTT symbol, or by scanning
+// the data memories for its identifier.
+//
+// A thread of the bridge polls the write offsets of the up buffers and drains
+// them with bulk accesses of at most one queue slice, without halting the
+// cores and without gdb. Buffers outside of the data memories are ignored. Up
+// buffer n goes to the output of channel n, a TCP port, a Unix domain socket
+// or a file. What a socket client sends goes to down buffer n.
+class Rtt {
+  public:
+    Rtt(MemIF* mem);
+    ~Rtt();
+
+    // Where to look for the control block, addr 0 to scan the regions
+    void set_address(uint32_t addr) { m_addr = addr; }
+    void add_region(uint32_t addr, uint32_t len);
+
+    // tcp:<port>, unix:<path> or the path of a file
+    bool add_channel(unsigned int index, const char* output);
+
+    bool start();
+    void stop();
+
+    // Where the control block is and the bytes moved on each channel
+    void get_report(char* str, size_t len);
+
+  private:
+    // as laid out in target memory
+    struct buffer_desc {
+      uint32_t name;
+      uint32_t buffer;
+      uint32_t size;
+      uint32_t wr_off;
+      uint32_t rd_off;
+      uint32_t flags;
+    };
+
+    struct channel {
+      unsigned int index;
+      int fd;         // file, or connected client, -1 if none
+      int listen_fd;  // -1 for a file
+      char* unix_path;
+      unsigned long long up_bytes;
+      unsigned long long down_bytes;
+    };
+
+    void run();
+    bool locate(uint32_t* cb);
+    bool check(uint32_t addr);
+    bool poll(bool* moved);
+    bool valid(struct buffer_desc* desc);
+    bool drain(struct channel* channel, struct buffer_desc* desc, uint32_t desc_addr, bool* moved);
+    bool fill(struct channel* channel, struct buffer_desc* desc, uint32_t desc_addr, bool* moved);
+    void accept_client(struct channel* channel);
+    bool forward(struct channel* channel, const char* data, size_t len);
+
+    MemIF* m_mem;
+
+    uint32_t m_addr;
+    std::list<std::pair<uint32_t, uint32_t> > m_regions;
+    std::list<struct channel> m_channels;
+
+    // control block found by the thread, 0 until then
+    uint32_t m_cb;
+    uint32_t m_nb_up;
+    uint32_t m_nb_down;
+
+    std::vector<struct buffer_desc> m_descs;
+    std::vector<char> m_data;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_started;
+    bool m_stop;
+};
+
+#endif
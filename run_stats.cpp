@@ -0,0 +1,138 @@
+
+#include "run_stats.h"
+#include "perf.h"
+
+#include <stdio.h>
+
+RunStats::RunStats(MemIF* mem) {
+  m_mem = mem;
+  m_enabled = false;
+  m_running = false;
+  m_last_seconds = 0;
+  m_runs = 0;
+  m_total_seconds = 0;
+}
+
+void
+RunStats::set_cores(std::list<DbgIF*> cores) {
+  m_cores = cores;
+  m_enabled = false;
+  m_running = false;
+  m_runs = 0;
+  m_total_seconds = 0;
+  m_last.clear();
+  m_total.assign(m_cores.size(), 0);
+}
+
+bool
+RunStats::enable() {
+  std::vector<struct mem_txn> txns;
+  std::vector<uint32_t> pcer(m_cores.size());
+  std::vector<uint32_t> pcmr(m_cores.size());
+
+  // keep the events counted by someone else
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, i++) {
+    txns.push_back((*it)->txn(0, 0x4000 + PERF_PCER * 4, &pcer[i]));
+    txns.push_back((*it)->txn(0, 0x4000 + PERF_PCMR * 4, &pcmr[i]));
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  txns.clear();
+  for (i = 0; i < m_cores.size(); i++) {
+    pcer[i] |= 1;
+    pcmr[i] |= 1;
+  }
+
+  i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, i++) {
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCER * 4, &pcer[i]));
+    txns.push_back((*it)->txn(1, 0x4000 + PERF_PCMR * 4, &pcmr[i]));
+  }
+
+  m_enabled = m_mem->access_batch(&txns[0], txns.size());
+  return m_enabled;
+}
+
+bool
+RunStats::read(std::vector<uint32_t>* cycles) {
+  std::vector<struct mem_txn> txns;
+
+  cycles->resize(m_cores.size());
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end(); it++, i++) {
+    txns.push_back((*it)->txn(0, 0x4000 + PERF_PCCR * 4, &(*cycles)[i]));
+  }
+
+  return m_mem->access_batch(&txns[0], txns.size());
+}
+
+bool
+RunStats::start() {
+  if (m_cores.empty())
+    return true;
+
+  if (!m_enabled && !this->enable()) {
+    fprintf(stderr, "RunStats: Failed enabling the cycle counters\n");
+    return false;
+  }
+
+  if (!this->read(&m_start))
+    return false;
+
+  m_running = true;
+  m_start_time = clock::now();
+  return true;
+}
+
+bool
+RunStats::stop() {
+  std::vector<uint32_t> cycles;
+
+  if (!m_running)
+    return true;
+
+  m_running = false;
+  m_last_seconds = std::chrono::duration<double>(clock::now() - m_start_time).count();
+
+  if (!this->read(&cycles))
+    return false;
+
+  // the counters are 32 bits wide, a run longer than that wraps around
+  m_last.resize(m_cores.size());
+  for (size_t i = 0; i < m_cores.size(); i++) {
+    m_last[i] = cycles[i] - m_start[i];
+    m_total[i] += m_last[i];
+  }
+
+  m_runs++;
+  m_total_seconds += m_last_seconds;
+  return true;
+}
+
+void
+RunStats::get_report(char* str, size_t len) {
+  int pos = 0;
+
+  if (m_runs == 0) {
+    snprintf(str, len, "No run yet\n");
+    return;
+  }
+
+  pos += snprintf(&str[pos], len - pos, "Last run: %.3f s on the host\n", m_last_seconds);
+  pos += snprintf(&str[pos], len - pos, "%-6s %12s %12s %14s\n", "core", "cycles", "kcycles/s", "total cycles");
+
+  size_t i = 0;
+  for (std::list<DbgIF*>::iterator it = m_cores.begin(); it != m_cores.end() && pos < (int)len; it++, i++) {
+    double rate = m_last_seconds > 0 ? m_last[i] / m_last_seconds / 1e3 : 0;
+
+    pos += snprintf(&str[pos], len - pos, "%-6X %12u %12.1f %14llu\n",
+      (*it)->get_thread_id(), m_last[i], rate, m_total[i]);
+  }
+
+  if (pos < (int)len)
+    snprintf(&str[pos], len - pos, "%u runs, %.3f s on the host in total\n", m_runs, m_total_seconds);
+}
@@ -0,0 +1,51 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include "mem.h"
+#include "debug_if.h"
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <chrono>
+
+// Measures every run of the cores, from their resume to their stop: the
+// cycles counted by each core and the host time it took. The cycle counter is
+// the first performance counter (there is no mcycle on RI5CY), it is enabled
+// the first time and then read with one batch at each resume and stop.
+class RunStats {
+  public:
+    RunStats(MemIF* mem);
+
+    // The cores changed, the counter has to be enabled again
+    void set_cores(std::list<DbgIF*> cores);
+
+    // The cores are about to be resumed or have just stopped
+    bool start();
+    bool stop();
+
+    // Last run, and all runs since the cores were set
+    void get_report(char* str, size_t len);
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    bool enable();
+    bool read(std::vector<uint32_t>* cycles);
+
+    MemIF* m_mem;
+    std::list<DbgIF*> m_cores;
+    bool m_enabled;
+    bool m_running;
+
+    clock::time_point m_start_time;
+    std::vector<uint32_t> m_start;
+    std::vector<uint32_t> m_last;
+    double m_last_seconds;
+
+    unsigned int m_runs;
+    std::vector<unsigned long long> m_total;
+    double m_total_seconds;
+};
+
+#endif
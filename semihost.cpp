@@ -0,0 +1,303 @@
+
+#include "semihost.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// fopen modes as numbered by SYS_OPEN: r, rb, r+, r+b, w, wb, w+, w+b, a, ab, a+, a+b
+static const int s_open_flags[] = {
+  O_RDONLY, O_RDONLY, O_RDWR, O_RDWR,
+  O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC, O_RDWR | O_CREAT | O_TRUNC,
+  O_WRONLY | O_CREAT | O_APPEND, O_WRONLY | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND, O_RDWR | O_CREAT | O_APPEND,
+};
+
+Semihost::Semihost(MemIF* mem, BreakPoints* bp, Loader* loader, bool console_in) {
+  m_mem = mem;
+  m_bp = bp;
+  m_loader = loader;
+  m_console_in = console_in;
+  m_errno = 0;
+  m_start = std::chrono::steady_clock::now();
+}
+
+Semihost::~Semihost() {
+  for (size_t i = 0; i < m_fds.size(); i++) {
+    close(m_fds[i]);
+  }
+}
+
+int
+Semihost::nb_args(uint32_t op) {
+  switch (op) {
+    case SEMIHOST_SYS_OPEN:
+    case SEMIHOST_SYS_WRITE:
+    case SEMIHOST_SYS_READ:
+      return 3;
+
+    case SEMIHOST_SYS_SEEK:
+    case SEMIHOST_SYS_EXIT_EXTENDED:
+      return 2;
+
+    case SEMIHOST_SYS_CLOSE:
+    case SEMIHOST_SYS_ISTTY:
+    case SEMIHOST_SYS_FLEN:
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+bool
+Semihost::ready(uint32_t op, uint32_t* args) {
+  if (op != SEMIHOST_SYS_READ || args[0] != 0 || !m_console_in)
+    return true;
+
+  struct pollfd pfd = { 0, POLLIN, 0 };
+  return poll(&pfd, 1, 0) != 0;
+}
+
+// Only the console and the files opened by the target can be accessed
+bool
+Semihost::valid(uint32_t fd) {
+  if (fd <= 2 || std::find(m_fds.begin(), m_fds.end(), (int)fd) != m_fds.end())
+    return true;
+
+  m_errno = EBADF;
+  return false;
+}
+
+bool
+Semihost::read_string(uint32_t addr, uint32_t len, std::vector<char>* str) {
+  str->resize(len + 1);
+
+  if (len && !m_mem->access(0, addr, len, &(*str)[0]))
+    return false;
+
+  m_bp->hide(addr, len, &(*str)[0]);
+  (*str)[len] = '\0';
+  return true;
+}
+
+bool
+Semihost::from_target(int fd, uint32_t addr, uint32_t len, uint32_t* result) {
+  std::vector<char> buffer(std::min(len, (uint32_t)SEMIHOST_BURST));
+  uint32_t done = 0;
+
+  while (done < len) {
+    uint32_t burst = std::min(len - done, (uint32_t)SEMIHOST_BURST);
+
+    if (!m_mem->access(0, addr + done, burst, &buffer[0]))
+      return false;
+
+    m_bp->hide(addr + done, burst, &buffer[0]);
+
+    ssize_t written = ::write(fd, &buffer[0], burst);
+    if (written < 0) {
+      m_errno = errno;
+      break;
+    }
+
+    done += written;
+    if ((uint32_t)written < burst)
+      break;
+  }
+
+  // the number of bytes which were not written
+  *result = len - done;
+  return true;
+}
+
+bool
+Semihost::to_target(int fd, uint32_t addr, uint32_t len, uint32_t* result) {
+  std::vector<char> buffer(std::min(len, (uint32_t)SEMIHOST_BURST));
+  uint32_t done = 0;
+
+  while (done < len) {
+    uint32_t burst = std::min(len - done, (uint32_t)SEMIHOST_BURST);
+
+    ssize_t nb_read = ::read(fd, &buffer[0], burst);
+    if (nb_read < 0) {
+      m_errno = errno;
+      break;
+    }
+
+    if (nb_read > 0) {
+      if (!m_mem->access(1, addr + done, nb_read, &buffer[0]))
+        return false;
+
+      m_bp->written(addr + done, nb_read, &buffer[0]);
+      m_loader->written(addr + done, nb_read);
+    }
+
+    done += nb_read;
+
+    // end of file, or a console which gave what it had, it is not read again
+    // as that could wait
+    if ((uint32_t)nb_read < burst || fd == 0)
+      break;
+  }
+
+  // the number of bytes which were not read
+  *result = len - done;
+  return true;
+}
+
+bool
+Semihost::call(uint32_t op, uint32_t* args, uint32_t* result, bool* exited, int* exit_code) {
+  std::vector<char> str;
+  struct stat st;
+  int fd;
+
+  *exited = false;
+  *result = (uint32_t)-1;
+
+  switch (op) {
+    case SEMIHOST_SYS_OPEN:
+      // the length comes from the target, a path is never that long
+      if (args[2] >= PATH_MAX) {
+        m_errno = ENAMETOOLONG;
+        return true;
+      }
+
+      if (!this->read_string(args[0], args[2], &str))
+        return false;
+
+      if (args[1] >= sizeof(s_open_flags) / sizeof(s_open_flags[0])) {
+        m_errno = EINVAL;
+        return true;
+      }
+
+      if (strcmp(&str[0], ":tt") == 0) {
+        // read modes give stdin, write modes stdout and append modes stderr
+        *result = args[1] < 4 ? 0 : args[1] < 8 ? 1 : 2;
+        return true;
+      }
+
+      fd = open(&str[0], s_open_flags[args[1]], 0644);
+      if (fd == -1) {
+        m_errno = errno;
+        return true;
+      }
+
+      m_fds.push_back(fd);
+      *result = fd;
+      return true;
+
+    case SEMIHOST_SYS_CLOSE:
+      if (std::find(m_fds.begin(), m_fds.end(), (int)args[0]) == m_fds.end()) {
+        // the console stays open
+        *result = args[0] <= 2 ? 0 : -1;
+        return true;
+      }
+
+      m_fds.erase(std::find(m_fds.begin(), m_fds.end(), (int)args[0]));
+      *result = close(args[0]);
+      return true;
+
+    case SEMIHOST_SYS_WRITEC:
+      if (!this->read_string(args[0], 1, &str))
+        return false;
+
+      fputc(str[0], stdout);
+      fflush(stdout);
+      return true;
+
+    case SEMIHOST_SYS_WRITE0:
+      // the length is unknown, read by chunks until the terminating zero
+      while (1) {
+        if (!this->read_string(args[0], 64, &str))
+          return false;
+
+        size_t len = strlen(&str[0]);
+        fwrite(&str[0], 1, len, stdout);
+        if (len < 64)
+          break;
+
+        args[0] += 64;
+      }
+
+      fflush(stdout);
+      return true;
+
+    case SEMIHOST_SYS_WRITE:
+      if (!this->valid(args[0]))
+        return true;
+
+      fflush(stdout);
+      return this->from_target(args[0], args[1], args[2], result);
+
+    case SEMIHOST_SYS_READ:
+      if (!this->valid(args[0]))
+        return true;
+
+      if (args[0] == 0 && !m_console_in) {
+        m_errno = EBADF;
+        return true;
+      }
+
+      return this->to_target(args[0], args[1], args[2], result);
+
+    case SEMIHOST_SYS_ISTTY:
+      if (!this->valid(args[0]))
+        return true;
+
+      *result = isatty(args[0]);
+      return true;
+
+    case SEMIHOST_SYS_SEEK:
+      if (!this->valid(args[0]))
+        return true;
+
+      if (lseek(args[0], args[1], SEEK_SET) == -1)
+        m_errno = errno;
+      else
+        *result = 0;
+      return true;
+
+    case SEMIHOST_SYS_FLEN:
+      if (!this->valid(args[0]))
+        return true;
+
+      if (fstat(args[0], &st) == -1)
+        m_errno = errno;
+      else
+        *result = st.st_size;
+      return true;
+
+    case SEMIHOST_SYS_CLOCK:
+      *result = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_start).count() / 10;
+      return true;
+
+    case SEMIHOST_SYS_TIME:
+      *result = time(NULL);
+      return true;
+
+    case SEMIHOST_SYS_ERRNO:
+      *result = m_errno;
+      return true;
+
+    case SEMIHOST_SYS_EXIT:
+      *exited = true;
+      *exit_code = args[0] == SEMIHOST_EXIT_APPLICATION ? 0 : 1;
+      return true;
+
+    case SEMIHOST_SYS_EXIT_EXTENDED:
+      *exited = true;
+      *exit_code = args[0] == SEMIHOST_EXIT_APPLICATION ? args[1] : 1;
+      return true;
+
+    default:
+      fprintf(stderr, "Semihost: Unsupported operation 0x%X\n", op);
+      m_errno = ENOSYS;
+      return true;
+  }
+}
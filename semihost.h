@@ -0,0 +1,72 @@
+#ifndef SEMIHOST_H
+#define SEMIHOST_H
+
+#include "mem.h"
+#include "breakpoints.h"
+#include "loader.h"
+
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+// Operations, cf. the ARM semihosting specification which RISC-V follows
+#define SEMIHOST_SYS_OPEN          0x01
+#define SEMIHOST_SYS_CLOSE         0x02
+#define SEMIHOST_SYS_WRITEC        0x03
+#define SEMIHOST_SYS_WRITE0        0x04
+#define SEMIHOST_SYS_WRITE         0x05
+#define SEMIHOST_SYS_READ          0x06
+#define SEMIHOST_SYS_ISTTY         0x09
+#define SEMIHOST_SYS_SEEK          0x0A
+#define SEMIHOST_SYS_FLEN          0x0C
+#define SEMIHOST_SYS_CLOCK         0x10
+#define SEMIHOST_SYS_TIME          0x11
+#define SEMIHOST_SYS_ERRNO         0x13
+#define SEMIHOST_SYS_EXIT          0x18
+#define SEMIHOST_SYS_EXIT_EXTENDED 0x20
+
+// Reason given to SYS_EXIT by a program which returns normally
+#define SEMIHOST_EXIT_APPLICATION 0x20026
+
+// Biggest buffer handed to the memory interface at once for reads and writes
+#define SEMIHOST_BURST (1 << 20)
+
+// Host side of semihosting. A core does a call with an ecall, with the
+// operation in a0 and the address of its argument block in a1. The result is
+// returned in a0. File handles are host file descriptors, the console (":tt")
+// being stdin, stdout and stderr. Reads from stdin fail when console_in is
+// false, e.g. when stdin carries the packets of gdb.
+class Semihost {
+  public:
+    Semihost(MemIF* mem, BreakPoints* bp, Loader* loader, bool console_in);
+    ~Semihost();
+
+    // The argument block of an operation, in words
+    static int nb_args(uint32_t op);
+
+    // False while the operation would wait, i.e. a read from the console which
+    // has nothing to give yet
+    bool ready(uint32_t op, uint32_t* args);
+
+    // Does the operation, args are the words of the argument block, or a1
+    // itself for the operations which take a single value
+    bool call(uint32_t op, uint32_t* args, uint32_t* result, bool* exited, int* exit_code);
+
+  private:
+    bool valid(uint32_t fd);
+    bool read_string(uint32_t addr, uint32_t len, std::vector<char>* str);
+    bool to_target(int fd, uint32_t addr, uint32_t len, uint32_t* result);
+    bool from_target(int fd, uint32_t addr, uint32_t len, uint32_t* result);
+
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+    Loader* m_loader;
+    bool m_console_in;
+
+    // files opened by the target, closed when the session ends
+    std::vector<int> m_fds;
+    int m_errno;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
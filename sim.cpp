@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -41,12 +42,16 @@ SimIF::SimIF(const char* mem_server, int port) {
     return;
   }
 
+  // every access waits for its response, don't let them linger in the stack
+  int yes = 1;
+  setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+
   printf("Mem connected!\n");
 }
 
-bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
+bool SimIF::send_request(bool write, unsigned int addr, int size, char* buffer) {
   int ret;
-  char data[1024];
+  char data[9];
   // packet header looks like this:
   // Write (in LSB)
   // ADDR[31:0]
@@ -55,8 +60,6 @@ bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
   // after that follows the data in the buffer (for a write), starting at the lowest byte
   // for a read, the packet is finished with SIZE
 
-  memset(data, 0, sizeof(data));
-
   data[0] = write ? 1 : 0;
   data[1] = (addr >>  0) & 0xFF;
   data[2] = (addr >>  8) & 0xFF;
@@ -67,22 +70,31 @@ bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
   data[7] = (size >> 16) & 0xFF;
   data[8] = (size >> 24) & 0xFF;
 
-  ret = send(m_socket, data, 9, 0);
+  // for a write, let the header go out together with the data
+  ret = send(m_socket, data, 9, write ? MSG_MORE : 0);
   if (ret != 9) {
     fprintf(stderr, "Unable to send header to simulator: %s\n", strerror(errno));
     return false;
   }
 
   if (write) {
-    // write
     ret = send(m_socket, buffer, size, 0);
     if (ret != size) {
       fprintf(stderr, "Unable to send buffer to simulator: %s\n", strerror(errno));
       return false;
     }
+  }
+
+  return true;
+}
+
+bool SimIF::recv_response(bool write, int size, char* buffer) {
+  int ret;
+  char data[5];
 
+  if (write) {
     // check response
-    ret = recv(m_socket, data, 5, 0);
+    ret = recv(m_socket, data, 5, MSG_WAITALL);
     if (ret == -1 || ret == 0) {
       fprintf(stderr, "Unable to get a response from simulator: %s\n", strerror(errno));
       return false;
@@ -99,7 +111,7 @@ bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
     }
   } else {
     // read
-    ret = recv(m_socket, data, 5, 0);
+    ret = recv(m_socket, data, 5, MSG_WAITALL);
     if (ret == -1 || ret == 0) {
       fprintf(stderr, "Unable to get a response from simulator: %s\n", strerror(errno));
       return false;
@@ -110,8 +122,8 @@ bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
       return false;
     }
 
-    uint32_t size = (data[1] << 0) | (data[2] << 8) | (data[3] << 16) | (data[4] << 24);
-    ret = recv(m_socket, buffer, size, 0);
+    uint32_t size = ((uint8_t)data[1] << 0) | ((uint8_t)data[2] << 8) | ((uint8_t)data[3] << 16) | ((uint8_t)data[4] << 24);
+    ret = recv(m_socket, buffer, size, MSG_WAITALL);
     if (ret == -1 || ret == 0) {
       fprintf(stderr, "Unable to get a response from simulator: %s\n", strerror(errno));
       return false;
@@ -128,15 +140,65 @@ bool SimIF::access_raw(bool write, unsigned int addr, int size, char* buffer) {
 
 bool
 SimIF::access(bool write, unsigned int addr, int size, char* buffer) {
-  bool retval = true;
+  // bigger accesses are cut into 1024 byte chunks, which are pipelined
+  struct mem_txn txn = { write, addr, size, buffer };
+  return this->access_batch(&txn, 1);
+}
 
-  // break into 1024 byte chunks
-  while (size > 0) {
-    retval = retval && this->access_raw(write, addr, size, buffer);
+bool
+SimIF::access_batch(struct mem_txn* txns, int nb_txns) {
+  struct chunk {
+    bool write;
+    int size;
+    char* buffer;
+  };
+  std::list<struct chunk> in_flight;
+  int in_flight_bytes = 0;
+  bool retval = true;
+  int i = 0;
+  unsigned int addr = nb_txns ? txns[0].addr : 0;
+  int size = nb_txns ? txns[0].size : 0;
+  char* buffer = nb_txns ? txns[0].buffer : NULL;
+
+  // All requests are sent without waiting for the previous responses, the
+  // simulator serves them in order. Only a bounded amount of data is left in
+  // flight, so that neither side can block on a full socket.
+  while (i < nb_txns || !in_flight.empty()) {
+    if (i < nb_txns && size <= 0) {
+      i++;
+      if (i < nb_txns) {
+        addr   = txns[i].addr;
+        size   = txns[i].size;
+        buffer = txns[i].buffer;
+      }
+      continue;
+    }
 
-    addr   += 1024;
-    size   -= 1024;
-    buffer += 1024;
+    if (i < nb_txns && (in_flight.empty() || in_flight_bytes + 1024 + 9 <= SIM_PIPELINE_BYTES)) {
+      struct chunk chunk = { txns[i].write, size > 1024 ? 1024 : size, buffer };
+
+      // the responses of what was sent are still drained, so that the next
+      // batch does not read them
+      if (!this->send_request(chunk.write, addr, chunk.size, chunk.buffer)) {
+        retval = false;
+        i = nb_txns;
+        continue;
+      }
+
+      in_flight.push_back(chunk);
+      in_flight_bytes += chunk.size + 9;
+
+      addr   += chunk.size;
+      size   -= chunk.size;
+      buffer += chunk.size;
+    } else {
+      struct chunk chunk = in_flight.front();
+      in_flight.pop_front();
+      in_flight_bytes -= chunk.size + 9;
+
+      // a failed access does not break the stream, keep on draining
+      retval = this->recv_response(chunk.write, chunk.size, chunk.buffer) && retval;
+    }
   }
 
   return retval;
@@ -3,14 +3,19 @@
 
 #include "mem.h"
 
+// Maximum amount of bytes a batch keeps in flight towards the simulator
+#define SIM_PIPELINE_BYTES 16384
+
 class SimIF : public MemIF {
   public:
     SimIF(const char* mem_server, int port);
 
     bool access(bool write, unsigned int addr, int size, char* buffer);
+    bool access_batch(struct mem_txn* txns, int nb_txns);
 
   private:
-    bool access_raw(bool write, unsigned int addr, int size, char* buffer);
+    bool send_request(bool write, unsigned int addr, int size, char* buffer);
+    bool recv_response(bool write, int size, char* buffer);
 
     const char* m_server;
     int m_port;
@@ -0,0 +1,368 @@
+
+#include "trace.h"
+
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <set>
+
+Trace::Trace(MemIF* mem, BreakPoints* bp) {
+  m_mem = mem;
+  m_bp = bp;
+  m_nb_pcs = 0;
+  m_steps = 0;
+  m_seconds = 0;
+  m_end[0] = '\0';
+}
+
+void
+Trace::restart(std::vector<DbgIF*>* cores, std::vector<uint32_t>* pcs) {
+  m_thread_ids.clear();
+  for (size_t i = 0; i < cores->size(); i++)
+    m_thread_ids.push_back((*cores)[i]->get_thread_id());
+
+  m_first = *pcs;
+  m_last = *pcs;
+  m_nb_pcs = 1;
+  m_deltas.clear();
+  m_steps = 0;
+  snprintf(m_end, sizeof(m_end), "all steps done");
+}
+
+void
+Trace::append(size_t core, uint32_t pc) {
+  int32_t delta = pc - m_last[core];
+  uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    m_deltas.push_back(value ? byte | 0x80 : byte);
+  } while (value);
+
+  m_last[core] = pc;
+}
+
+bool
+Trace::enable_all(std::set<unsigned int>* disabled) {
+  if (disabled->empty())
+    return true;
+
+  for (std::set<unsigned int>::iterator it = disabled->begin(); it != disabled->end(); it++)
+    m_bp->enable(*it);
+
+  return m_bp->commit();
+}
+
+bool
+Trace::record(DbgIF* dbgif, uint32_t pc, unsigned int nb_steps) {
+  std::set<unsigned int> disabled;
+  uint32_t hit = 0;
+  uint32_t ctrl_step = 0x1;
+  uint32_t status[2];  // CTRL and HIT
+  uint32_t npc = pc;
+  bool retval = true;
+
+  std::vector<DbgIF*> cores(1, dbgif);
+  std::vector<uint32_t> pcs(1, pc);
+  this->restart(&cores, &pcs);
+
+  struct mem_txn txns[4] = {
+    dbgif->txn(1, DBG_HIT_REG, &hit),
+    dbgif->txn(1, DBG_CTRL_REG, &ctrl_step),
+    dbgif->txn(0, DBG_CTRL_REG, status),
+    dbgif->txn(0, DBG_NPC_REG, &npc),
+  };
+  txns[2].size = 2 * 4;
+
+  if (!dbgif->write(DBG_NPC_REG, pc))
+    return false;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while (m_steps < nb_steps) {
+    // a breakpoint which is about to be executed stays out of memory until
+    // the end of the trace
+    if (m_bp->at_addr(npc) && disabled.insert(npc).second) {
+      m_bp->disable(npc);
+      m_bp->commit();
+    }
+
+    if (!m_mem->access_batch(txns, 4)) {
+      snprintf(m_end, sizeof(m_end), "target access failed");
+      retval = false;
+      break;
+    }
+
+    // the step is usually over by the time CTRL is read
+    if (!(status[0] & (1 << 16))) {
+      std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(TRACE_STEP_TIMEOUT_MS);
+
+      while (!(status[0] & (1 << 16)) && std::chrono::steady_clock::now() < timeout) {
+        if (!m_mem->access_batch(&txns[2], 1))
+          break;
+      }
+
+      if (!(status[0] & (1 << 16)) || !dbgif->read(DBG_NPC_REG, &npc)) {
+        snprintf(m_end, sizeof(m_end), "core did not halt after a step");
+        retval = false;
+        break;
+      }
+    }
+
+    // e.g. an exception which enters debug mode
+    if (!(status[1] & 1)) {
+      uint32_t cause = 0;
+      dbgif->read(DBG_CAUSE_REG, &cause);
+      snprintf(m_end, sizeof(m_end), "core stopped with cause 0x%x", cause);
+      break;
+    }
+
+    this->append(0, npc);
+    m_nb_pcs++;
+    m_steps++;
+  }
+
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return this->enable_all(&disabled) && retval;
+}
+
+bool
+Trace::record_cluster(std::vector<DbgIF*> cores, std::vector<uint32_t> pcs, unsigned int nb_steps) {
+  std::set<unsigned int> disabled;
+  std::vector<struct mem_txn> txns;
+  size_t nb_cores = cores.size();
+  std::vector<uint32_t> status(nb_cores * 2);  // CTRL and HIT of each core
+  std::vector<uint32_t> npc(pcs);
+  uint32_t hit = 0;
+  uint32_t ctrl_step = (1 << 16) | 0x1;
+  uint32_t ctrl_halt = 1 << 16;
+  uint32_t mask = 0;
+  bool retval = true;
+
+  this->restart(&cores, &pcs);
+
+  // the cores stay halted with single-step set, they then do one step each
+  // time the cluster controller resumes them
+  for (size_t i = 0; i < nb_cores; i++) {
+    txns.push_back(cores[i]->txn(1, DBG_NPC_REG, &pcs[i]));
+    txns.push_back(cores[i]->txn(1, DBG_CTRL_REG, &ctrl_step));
+    mask |= 1 << (cores[i]->get_thread_id() & 0x1F);
+  }
+
+  if (!m_mem->access_batch(&txns[0], txns.size()))
+    return false;
+
+  txns.clear();
+  for (size_t i = 0; i < nb_cores; i++)
+    txns.push_back(cores[i]->txn(1, DBG_HIT_REG, &hit));
+
+  struct mem_txn resume = { true, CLUSTER_RESUME_REG, 4, (char*)&mask };
+  txns.push_back(resume);
+
+  size_t reads = txns.size();
+  for (size_t i = 0; i < nb_cores; i++) {
+    struct mem_txn txn = cores[i]->txn(0, DBG_CTRL_REG, &status[i * 2]);
+    txn.size = 2 * 4;
+    txns.push_back(txn);
+    txns.push_back(cores[i]->txn(0, DBG_NPC_REG, &npc[i]));
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while (m_steps < nb_steps) {
+    bool changed = false;
+    for (size_t i = 0; i < nb_cores; i++) {
+      if (m_bp->at_addr(npc[i]) && disabled.insert(npc[i]).second) {
+        m_bp->disable(npc[i]);
+        changed = true;
+      }
+    }
+    if (changed)
+      m_bp->commit();
+
+    if (!m_mem->access_batch(&txns[0], txns.size())) {
+      snprintf(m_end, sizeof(m_end), "target access failed");
+      retval = false;
+      break;
+    }
+
+    // the steps are usually over by the time CTRL is read, a core waiting
+    // for an event is not
+    std::chrono::steady_clock::time_point timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(TRACE_STEP_TIMEOUT_MS);
+    size_t running = nb_cores;
+
+    while (running) {
+      running = 0;
+      for (size_t i = 0; i < nb_cores; i++) {
+        if (!(status[i * 2] & (1 << 16)))
+          running = i + 1;
+      }
+
+      if (!running || std::chrono::steady_clock::now() >= timeout)
+        break;
+
+      if (!m_mem->access_batch(&txns[reads], txns.size() - reads))
+        break;
+    }
+
+    if (running) {
+      snprintf(m_end, sizeof(m_end), "core %u did not halt after a step", m_thread_ids[running - 1]);
+      retval = false;
+      break;
+    }
+
+    for (size_t i = 0; i < nb_cores; i++)
+      this->append(i, npc[i]);
+    m_nb_pcs++;
+    m_steps++;
+
+    // e.g. an exception which enters debug mode, the other cores did step
+    size_t stopped;
+    for (stopped = 0; stopped < nb_cores; stopped++) {
+      if (!(status[stopped * 2 + 1] & 1))
+        break;
+    }
+
+    if (stopped < nb_cores) {
+      uint32_t cause = 0;
+      cores[stopped]->read(DBG_CAUSE_REG, &cause);
+      snprintf(m_end, sizeof(m_end), "core %u stopped with cause 0x%x", m_thread_ids[stopped], cause);
+      break;
+    }
+  }
+
+  m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // all cores are left halted, without single-step
+  txns.clear();
+  for (size_t i = 0; i < nb_cores; i++)
+    txns.push_back(cores[i]->txn(1, DBG_CTRL_REG, &ctrl_halt));
+
+  retval = m_mem->access_batch(&txns[0], txns.size()) && retval;
+
+  return this->enable_all(&disabled) && retval;
+}
+
+bool
+Trace::write(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Trace: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (m_thread_ids.size() == 1) {
+    uint32_t header[5] = { TRACE_MAGIC, TRACE_VERSION, m_thread_ids[0], m_nb_pcs, m_first[0] };
+    fwrite(header, sizeof(header), 1, file);
+  } else {
+    uint32_t header[4] = { TRACE_MAGIC, TRACE_VERSION_CLUSTER, (uint32_t)m_thread_ids.size(), m_nb_pcs };
+    std::vector<uint32_t> thread_ids(m_thread_ids.begin(), m_thread_ids.end());
+
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&thread_ids[0], thread_ids.size() * 4, 1, file);
+    fwrite(&m_first[0], m_first.size() * 4, 1, file);
+  }
+
+  if (m_deltas.size())
+    fwrite(&m_deltas[0], m_deltas.size(), 1, file);
+
+  bool retval = !ferror(file);
+  if (fclose(file) != 0 || !retval) {
+    fprintf(stderr, "Trace: Unable to write %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool
+Trace::decode(const char* path, FILE* out) {
+  uint32_t header[4] = { 0 };
+  uint32_t nb_cores = 1;
+  bool valid;
+
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Trace: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == TRACE_MAGIC &&
+    (header[1] == TRACE_VERSION || header[1] == TRACE_VERSION_CLUSTER);
+
+  if (valid && header[1] == TRACE_VERSION_CLUSTER) {
+    nb_cores = header[2];
+    valid = nb_cores > 0 && nb_cores <= 1024;
+  }
+
+  // thread ids and first PCs
+  std::vector<uint32_t> thread_ids(nb_cores, header[2]);
+  std::vector<uint32_t> pcs(nb_cores);
+
+  if (valid && header[1] == TRACE_VERSION_CLUSTER)
+    valid = fread(&thread_ids[0], nb_cores * 4, 1, file) == 1;
+  if (valid)
+    valid = fread(&pcs[0], nb_cores * 4, 1, file) == 1;
+
+  if (!valid) {
+    fprintf(stderr, "Trace: %s is not a trace file\n", path);
+    fclose(file);
+    return false;
+  }
+
+  unsigned int nb_pcs = header[3];
+
+  if (header[1] == TRACE_VERSION) {
+    fprintf(out, "# core %u, %u PCs\n", thread_ids[0], nb_pcs);
+  } else {
+    fprintf(out, "# cores");
+    for (uint32_t c = 0; c < nb_cores; c++)
+      fprintf(out, " %u", thread_ids[c]);
+    fprintf(out, ", %u PCs each\n", nb_pcs);
+  }
+
+  for (unsigned int i = 0; i < nb_pcs; i++) {
+    for (uint32_t c = 0; c < nb_cores; c++) {
+      uint32_t value = 0;
+      int shift = 0;
+      int byte;
+
+      while (i > 0) {
+        byte = fgetc(file);
+        if (byte == EOF) {
+          fprintf(stderr, "Trace: %s is truncated after %u PCs\n", path, i);
+          fclose(file);
+          return false;
+        }
+
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+
+        if (!(byte & 0x80) || shift >= 35)
+          break;
+      }
+
+      pcs[c] += (value >> 1) ^ -(value & 1);
+      fprintf(out, c + 1 < nb_cores ? "0x%08x " : "0x%08x\n", pcs[c]);
+    }
+  }
+
+  fclose(file);
+  return true;
+}
+
+void
+Trace::get_report(char* str, size_t len) {
+  double rate = m_seconds > 0 ? m_steps / m_seconds : 0;
+
+  if (m_thread_ids.size() == 1) {
+    snprintf(str, len, "%u steps of core %u in %.3f s (%.0f steps/s), %u bytes of trace, %s\n",
+      m_steps, m_thread_ids[0], m_seconds, rate, (unsigned int)(m_deltas.size() + 5 * 4), m_end);
+  } else {
+    snprintf(str, len, "%u steps of %u cores in %.3f s (%.0f steps/s), %u bytes of trace, %s\n",
+      m_steps, (unsigned int)m_thread_ids.size(), m_seconds, rate,
+      (unsigned int)(m_deltas.size() + (4 + 2 * m_thread_ids.size()) * 4), m_end);
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "mem.h"
+#include "debug_if.h"
+#include "breakpoints.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <set>
+
+#define TRACE_MAGIC   0x52544350  // "PCTR"
+#define TRACE_VERSION 1
+// several cores stepped in lock-step
+#define TRACE_VERSION_CLUSTER 2
+
+// Highest number of steps of one trace
+#define TRACE_MAX_STEPS 100000000
+
+// Time in ms given to a core to do one step
+#define TRACE_STEP_TIMEOUT_MS 1000
+
+// Records the PC of a core instruction by instruction, by single-stepping it
+// from the bridge. A step is one batch: clear HIT, step through CTRL, read
+// CTRL and HIT to check the core is halted again, read NPC. Software
+// breakpoints are taken out of memory when the core has to execute them.
+//
+// The cores of a cluster can also be stepped in lock-step. Their CTRL is set
+// to single-step once, then each step is one batch: clear the HIT of all
+// cores, resume them together through the cluster controller, read the CTRL,
+// HIT and NPC of all cores.
+//
+// File layout: 32 bits words magic, version, thread id, number of PCs and
+// first PC, then every following PC as its difference to the previous one,
+// zigzag encoded as a LEB128 number, i.e. one byte per sequential
+// instruction. In lock-step, the version is 2, followed by the number of
+// cores and of steps, the thread ids and the first PCs, then the differences
+// of each step, core after core.
+class Trace {
+  public:
+    Trace(MemIF* mem, BreakPoints* bp);
+
+    // pc is where the core is stopped, it is the first PC of the trace. Stops
+    // early when the core halts for another reason than the step.
+    bool record(DbgIF* dbgif, uint32_t pc, unsigned int nb_steps);
+
+    // Same for cluster cores, pcs are where each of them is stopped. Stops
+    // early when any of them halts for another reason than the step.
+    bool record_cluster(std::vector<DbgIF*> cores, std::vector<uint32_t> pcs, unsigned int nb_steps);
+
+    bool write(const char* path);
+
+    // Prints the PCs of a trace file, one step per line
+    static bool decode(const char* path, FILE* out);
+
+    // Steps done, achieved rate and why the trace ended
+    void get_report(char* str, size_t len);
+
+  private:
+    void restart(std::vector<DbgIF*>* cores, std::vector<uint32_t>* pcs);
+    void append(size_t core, uint32_t pc);
+    bool enable_all(std::set<unsigned int>* disabled);
+
+    MemIF* m_mem;
+    BreakPoints* m_bp;
+
+    std::vector<unsigned int> m_thread_ids;
+    std::vector<uint32_t> m_first;
+    std::vector<uint32_t> m_last;
+    unsigned int m_nb_pcs;
+    std::vector<uint8_t> m_deltas;
+
+    unsigned int m_steps;
+    double m_seconds;
+    char m_end[64];
+};
+
+#endif
@@ -0,0 +1,86 @@
+
+#include "transport.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+SocketTransport::~SocketTransport() {
+  ::close(m_socket);
+}
+
+ssize_t
+SocketTransport::read(char* buffer, size_t len) {
+  ssize_t ret = recv(m_socket, buffer, len, MSG_DONTWAIT);
+
+  if (ret == -1 && (errno == EWOULDBLOCK || errno == EINTR)) {
+    // no data available
+    errno = EWOULDBLOCK;
+  }
+
+  return ret;
+}
+
+bool
+SocketTransport::write(const char* buffer, size_t len) {
+  while (len > 0) {
+    ssize_t ret = send(m_socket, buffer, len, MSG_NOSIGNAL);
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    buffer += ret;
+    len    -= ret;
+  }
+
+  return true;
+}
+
+void
+SocketTransport::shutdown() {
+  ::shutdown(m_socket, SHUT_RDWR);
+}
+
+PipeTransport::~PipeTransport() {
+  ::close(m_fd_in);
+  if (m_fd_out != m_fd_in && m_fd_out != -1)
+    ::close(m_fd_out);
+}
+
+void
+PipeTransport::shutdown() {
+  // the other side closes its end once it sees ours closed
+  if (m_fd_out != m_fd_in && m_fd_out != -1) {
+    ::close(m_fd_out);
+    m_fd_out = -1;
+  }
+}
+
+ssize_t
+PipeTransport::read(char* buffer, size_t len) {
+  // only called once the reactor has seen data, thus this does not block
+  ssize_t ret = ::read(m_fd_in, buffer, len);
+
+  if (ret == -1 && errno == EINTR)
+    errno = EWOULDBLOCK;
+
+  return ret;
+}
+
+bool
+PipeTransport::write(const char* buffer, size_t len) {
+  while (len > 0) {
+    ssize_t ret = ::write(m_fd_out, buffer, len);
+    if (ret == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    buffer += ret;
+    len    -= ret;
+  }
+
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <unistd.h>
+#include <stdbool.h>
+
+// Byte stream over which the RSP packets are exchanged with GDB
+class Transport {
+  public:
+    virtual ~Transport(){};
+
+    // file descriptor to wait on for incoming data
+    virtual int get_fd() = 0;
+
+    // Reads what is available, returns 0 on end of stream and -1 on error
+    virtual ssize_t read(char* buffer, size_t len) = 0;
+    virtual bool write(const char* buffer, size_t len) = 0;
+
+    // Ends the stream from our side, the reader then sees the end of stream
+    virtual void shutdown() = 0;
+};
+
+// Connected TCP or Unix domain socket
+class SocketTransport : public Transport {
+  public:
+    SocketTransport(int socket) { m_socket = socket; }
+    ~SocketTransport();
+
+    int get_fd() { return m_socket; }
+    ssize_t read(char* buffer, size_t len);
+    bool write(const char* buffer, size_t len);
+    void shutdown();
+
+  private:
+    int m_socket;
+};
+
+// Pair of pipes, e.g. stdin/stdout when started by gdb with "target remote |"
+class PipeTransport : public Transport {
+  public:
+    PipeTransport(int fd_in, int fd_out) { m_fd_in = fd_in; m_fd_out = fd_out; }
+    ~PipeTransport();
+
+    int get_fd() { return m_fd_in; }
+    ssize_t read(char* buffer, size_t len);
+    bool write(const char* buffer, size_t len);
+    void shutdown();
+
+  private:
+    int m_fd_in;
+    int m_fd_out;
+};
+
+#endif
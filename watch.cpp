@@ -0,0 +1,228 @@
+
+#include "watch.h"
+#include "mem_queue.h"
+
+#include <string.h>
+#include <errno.h>
+
+Watch::Watch(MemIF* mem) {
+  m_mem = mem;
+  m_file = NULL;
+  m_binary = false;
+  m_hz = 0;
+  m_started = false;
+  m_stop = false;
+  m_samples = 0;
+  m_dropped = 0;
+  m_failed = 0;
+}
+
+Watch::~Watch() {
+  this->stop();
+}
+
+bool
+Watch::add(uint32_t addr, unsigned int size) {
+  if (m_started || m_vars.size() >= WATCH_MAX_VARS)
+    return false;
+
+  if (size != 1 && size != 2 && size != 4 && size != 8)
+    return false;
+
+  struct var var = { addr, size };
+  m_vars.push_back(var);
+  return true;
+}
+
+void
+Watch::clear() {
+  if (!m_started)
+    m_vars.clear();
+}
+
+bool
+Watch::start(const char* path, unsigned int hz, bool binary) {
+  if (m_started || m_vars.empty() || hz == 0 || hz > WATCH_MAX_HZ)
+    return false;
+
+  m_file = fopen(path, binary ? "wb" : "w");
+  if (m_file == NULL) {
+    fprintf(stderr, "Watch: Unable to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  m_binary = binary;
+  m_hz = hz;
+  m_period = std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(1000000 / hz));
+
+  // variables which follow each other in memory are read with one access
+  size_t total = 0;
+  for (size_t i = 0; i < m_vars.size(); i++)
+    total += m_vars[i].size;
+  m_values.resize(total);
+
+  m_txns.clear();
+  size_t offset = 0;
+  for (size_t i = 0; i < m_vars.size(); offset += m_vars[i].size, i++) {
+    struct mem_txn* last = m_txns.empty() ? NULL : &m_txns.back();
+
+    if (last && last->addr + last->size == m_vars[i].addr) {
+      last->size += m_vars[i].size;
+      continue;
+    }
+
+    struct mem_txn txn = { false, m_vars[i].addr, (int)m_vars[i].size, &m_values[offset] };
+    m_txns.push_back(txn);
+  }
+
+  if (!this->write_header()) {
+    fclose(m_file);
+    m_file = NULL;
+    return false;
+  }
+
+  m_samples = 0;
+  m_dropped = 0;
+  m_failed = 0;
+  m_stop = false;
+  m_started = true;
+  m_start = clock::now();
+  m_last = m_start;
+
+  m_thread = std::thread(&Watch::run, this);
+  return true;
+}
+
+void
+Watch::stop() {
+  if (!m_started)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_all();
+
+  m_thread.join();
+  m_started = false;
+
+  fclose(m_file);
+  m_file = NULL;
+}
+
+void
+Watch::run() {
+  // gdb requests go first, samples are dropped rather than delaying them
+  MemQueue::set_class(MEM_CLASS_BULK);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  clock::time_point next = m_start;
+
+  while (!m_stop) {
+    if (m_cond.wait_until(lock, next, [this] { return m_stop; }))
+      break;
+
+    lock.unlock();
+
+    clock::time_point issued = clock::now();
+    bool retval = m_mem->access_batch(&m_txns[0], m_txns.size());
+    clock::time_point done = clock::now();
+
+    // the sample is dated in the middle of the batch
+    uint64_t time_us = std::chrono::duration_cast<std::chrono::microseconds>(issued - m_start + (done - issued) / 2).count();
+
+    if (retval && !this->write_row(time_us))
+      retval = false;
+
+    lock.lock();
+
+    if (retval) {
+      m_samples++;
+      m_last = done;
+    } else {
+      m_failed++;
+    }
+
+    // periods which went by while sampling are lost
+    next += m_period;
+    if (done >= next) {
+      unsigned long long missed = (done - next) / m_period + 1;
+      m_dropped += missed;
+      next += m_period * missed;
+    }
+  }
+}
+
+bool
+Watch::write_header() {
+  if (!m_binary) {
+    fprintf(m_file, "time_us");
+    for (size_t i = 0; i < m_vars.size(); i++)
+      fprintf(m_file, ",0x%08x", m_vars[i].addr);
+    fprintf(m_file, "\n");
+  } else {
+    uint32_t header[4] = { WATCH_MAGIC, WATCH_VERSION, (uint32_t)m_vars.size(), m_hz };
+    fwrite(header, sizeof(header), 1, m_file);
+
+    for (size_t i = 0; i < m_vars.size(); i++) {
+      uint32_t var[2] = { m_vars[i].addr, m_vars[i].size };
+      fwrite(var, sizeof(var), 1, m_file);
+    }
+  }
+
+  if (ferror(m_file)) {
+    fprintf(stderr, "Watch: Unable to write the header: %s\n", strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool
+Watch::write_row(uint64_t time_us) {
+  if (m_binary) {
+    fwrite(&time_us, sizeof(time_us), 1, m_file);
+    fwrite(&m_values[0], m_values.size(), 1, m_file);
+  } else {
+    fprintf(m_file, "%llu", (unsigned long long)time_us);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < m_vars.size(); offset += m_vars[i].size, i++) {
+      uint64_t value = 0;
+      memcpy(&value, &m_values[offset], m_vars[i].size);
+      fprintf(m_file, ",%llu", (unsigned long long)value);
+    }
+
+    fprintf(m_file, "\n");
+  }
+
+  if (ferror(m_file)) {
+    fprintf(stderr, "Watch: Unable to write a sample: %s\n", strerror(errno));
+    clearerr(m_file);
+    return false;
+  }
+
+  return true;
+}
+
+void
+Watch::get_report(char* str, size_t len) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  int pos = 0;
+
+  if (m_vars.empty())
+    pos = snprintf(str, len, "No variables watched\n");
+
+  for (size_t i = 0; i < m_vars.size() && pos < (int)len; i++)
+    pos += snprintf(&str[pos], len - pos, "  0x%08x, %u bytes\n", m_vars[i].addr, m_vars[i].size);
+
+  if (pos >= (int)len || (!m_started && m_samples + m_dropped + m_failed == 0))
+    return;
+
+  double seconds = std::chrono::duration<double>(m_last - m_start).count();
+  double rate = seconds > 0 ? m_samples / seconds : 0;
+
+  snprintf(&str[pos], len - pos, "%s at %u Hz, %u accesses per sample: %llu samples (%.1f Hz), %llu dropped, %llu failed\n",
+    m_started ? "Streaming" : "Streamed", m_hz, (unsigned int)m_txns.size(), m_samples, rate, m_dropped, m_failed);
+}
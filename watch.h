@@ -0,0 +1,88 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Highest supported sampling frequency, and number of variables
+#define WATCH_MAX_HZ   10000
+#define WATCH_MAX_VARS 64
+
+// Binary streams start with this, cf. Watch
+#define WATCH_MAGIC   0x48435457  // "WTCH"
+#define WATCH_VERSION 1
+
+// Samples a set of variables periodically while the cores run, without
+// halting them. All variables are read with one batch per sample, variables
+// which are next to each other in memory with one access, by a thread of its
+// own in the bulk class of the memory queue, so that gdb requests are served
+// first. A sample which could not be taken in its period is dropped and
+// counted.
+//
+// Samples are written as CSV, time in us then one column per variable, or
+// in binary: a header of 32 bits words (magic, version, number of variables,
+// frequency, then the address and size of each variable), followed by one
+// row per sample (time in us on 64 bits, then the value of each variable with
+// its size, little endian).
+class Watch {
+  public:
+    Watch(MemIF* mem);
+    ~Watch();
+
+    // size is 1, 2, 4 or 8 bytes
+    bool add(uint32_t addr, unsigned int size);
+    void clear();
+    bool empty() { return m_vars.empty(); }
+
+    bool start(const char* path, unsigned int hz, bool binary);
+    void stop();
+    bool streaming() { return m_started; }
+
+    // Variables and streaming statistics
+    void get_report(char* str, size_t len);
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct var {
+      uint32_t addr;
+      unsigned int size;
+    };
+
+    void run();
+    bool write_header();
+    bool write_row(uint64_t time_us);
+
+    MemIF* m_mem;
+    std::vector<struct var> m_vars;
+
+    // values of the last sample, in the order of m_vars
+    std::vector<char> m_values;
+    std::vector<struct mem_txn> m_txns;
+
+    FILE* m_file;
+    bool m_binary;
+    unsigned int m_hz;
+    clock::duration m_period;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_started;
+    bool m_stop;
+
+    clock::time_point m_start;
+    clock::time_point m_last;
+    unsigned long long m_samples;
+    unsigned long long m_dropped;
+    unsigned long long m_failed;
+};
+
+#endif